@@ -0,0 +1,75 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+// LCD print throughput, in characters per second.
+//
+// Build against a tree before and after a change to the LCD data path to
+// compare them; this only needs lcd::init() and lcd::print(std::string).
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <iostream>
+#include <string>
+
+#include <tsxx/tsxx.hpp>
+
+int
+main(int argc, char *argv[])
+{
+	const unsigned int rounds = argc > 1 ? atoi(argv[1]) : 200;
+
+	tsxx::system::memory memory;
+	if (!memory.open()) {
+		std::cerr << "can't open /dev/mem" << std::endl;
+		return 1;
+	}
+
+	tsxx::ts7300::board board(memory);
+	board.init();
+
+	tsxx::ts7300::devices::lcd &lcd = board.get_lcd();
+	lcd.init();
+
+	// One DDRAM line, so every print is the same burst.
+	const std::string line(40, '#');
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (unsigned int i = 0; i < rounds; i++)
+		lcd.print(line);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	const double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	std::cout << rounds * line.size() << " chars in " << seconds << " s: " <<
+		rounds * line.size() / seconds << " chars/s" << std::endl;
+
+	return 0;
+}
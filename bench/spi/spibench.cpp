@@ -0,0 +1,136 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+// SPI write_read() throughput and CPU usage for a given transfer size.
+//
+// Only spi::init() and spi::write_read() are used, so the same program
+// builds against a tree before and after a change to the transfer engine
+// to compare them. No chip is selected: the frames are just clocked out.
+//
+// Given a spidev device (e.g. /dev/spidev0.0) as third argument, the
+// transfers go through the kernel driver instead of the mapped registers,
+// to compare both backends. Trees without spi::use_spidev() build with
+// -DSPIBENCH_NO_SPIDEV.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <iostream>
+#include <vector>
+
+#include <tsxx/tsxx.hpp>
+
+namespace
+{
+
+class
+no_chip
+	: public tsxx::interfaces::binport
+{
+public:
+	void
+	set()
+	{
+	}
+
+	void
+	unset()
+	{
+	}
+
+};
+
+double
+elapsed(const struct timespec &t0, const struct timespec &t1)
+{
+	return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+double
+cpu_seconds()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+}
+
+int
+main(int argc, char *argv[])
+{
+	const std::size_t size = argc > 1 ? atoi(argv[1]) : 4096;
+	const unsigned int rounds = argc > 2 ? atoi(argv[2]) : 100;
+
+	tsxx::system::memory memory;
+	if (!memory.open()) {
+		std::cerr << "can't open /dev/mem" << std::endl;
+		return 1;
+	}
+
+	tsxx::ts7300::board board(memory);
+	board.init();
+
+	tsxx::ts7300::devices::spi &spi = board.get_spi();
+#if !defined(SPIBENCH_NO_SPIDEV)
+	if (argc > 3) {
+		const int fd = open(argv[3], O_RDWR);
+		if (fd == -1) {
+			std::cerr << "can't open " << argv[3] << std::endl;
+			return 1;
+		}
+		spi.use_spidev(tsxx::system::file_descriptor_ptr(new tsxx::system::file_descriptor(fd)));
+	}
+#endif
+	no_chip cs;
+	std::vector<uint8_t> wr(size, 0x55), rd(size);
+
+	struct timespec t0, t1;
+	const double cpu0 = cpu_seconds();
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (unsigned int i = 0; i < rounds; i++)
+		spi.write_read(cs, &wr[0], wr.size(), &rd[0], rd.size());
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	const double cpu = cpu_seconds() - cpu0;
+
+	const double seconds = elapsed(t0, t1);
+	std::cout << (argc > 3 ? argv[3] : "mmap") << ": " <<
+		rounds << " x " << size << " bytes in " << seconds << " s: " <<
+		rounds * size / seconds / 1024 << " KiB/s, " <<
+		100 * cpu / seconds << "% CPU" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,374 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#if !defined(_TSXX_BUFFERS_HPP_)
+#define _TSXX_BUFFERS_HPP_
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <tsxx/exceptions.hpp>
+
+namespace tsxx
+{
+namespace buffers
+{
+
+/**
+ * Non-owning view of a contiguous array.
+ */
+template <class T> class
+span
+{
+public:
+	span()
+		: ptr(NULL), len(0)
+	{
+	}
+
+	span(T *p, std::size_t n)
+		: ptr(p), len(n)
+	{
+	}
+
+	template <std::size_t N>
+	span(T (&array)[N])
+		: ptr(array), len(N)
+	{
+	}
+
+	// Allows span<T> to span<const T> conversions.
+	template <class U>
+	span(const span<U> &other)
+		: ptr(other.data()), len(other.size())
+	{
+	}
+
+public:
+	inline T *
+	data() const
+	{
+		return ptr;
+	}
+
+	inline std::size_t
+	size() const
+	{
+		return len;
+	}
+
+	inline bool
+	empty() const
+	{
+		return len == 0;
+	}
+
+	inline T &
+	operator[](std::size_t i) const
+	{
+		return ptr[i];
+	}
+
+	span
+	subspan(std::size_t offset, std::size_t count) const
+	{
+		if (offset > len || count > len - offset)
+			throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+		return span(ptr + offset, count);
+	}
+
+private:
+	T *ptr;
+	std::size_t len;
+
+};
+
+/**
+ * Fixed number of equally sized buffers, allocated once when the pool is
+ * created. Taking and returning buffers never allocates.
+ *
+ * Pools aren't thread safe: use one pool per thread.
+ */
+template <class T> class
+pool
+	: private boost::noncopyable
+{
+public:
+	/**
+	 * @param count Number of buffers.
+	 * @param capacity Number of elements of each buffer.
+	 */
+	pool(std::size_t count, std::size_t capacity)
+		: storage(count * capacity), in_use(count, false), buffer_capacity(capacity)
+	{
+		if (count == 0 || capacity == 0)
+			throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+		free_list.reserve(count);
+		for (std::size_t i = count; i > 0; i--)
+			free_list.push_back(&storage[(i - 1) * capacity]);
+	}
+
+	/**
+	 * Takes a buffer from the pool.
+	 *
+	 * @throw tsxx::exceptions::not_enough_memory if all buffers are in
+	 * use.
+	 */
+	span<T>
+	acquire()
+	{
+		if (free_list.empty())
+			throw tsxx::exceptions::not_enough_memory();
+
+		T *p = free_list.back();
+		free_list.pop_back();
+		in_use[(p - &storage[0]) / buffer_capacity] = true;
+
+		return span<T>(p, buffer_capacity);
+	}
+
+	/**
+	 * Gives a buffer back to the pool. Only the start of the buffer
+	 * matters, so a subspan() starting at offset 0 can be released too.
+	 *
+	 * @throw tsxx::exceptions::invalid_state if the buffer isn't in use.
+	 */
+	void
+	release(span<T> buf)
+	{
+		if (buf.data() < &storage[0] || buf.data() >= &storage[0] + storage.size() ||
+				(buf.data() - &storage[0]) % buffer_capacity != 0)
+			throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+		const std::size_t index = (buf.data() - &storage[0]) / buffer_capacity;
+		if (!in_use[index])
+			throw tsxx::exceptions::invalid_state();
+
+		in_use[index] = false;
+		free_list.push_back(buf.data());
+	}
+
+	inline std::size_t
+	get_capacity() const
+	{
+		return buffer_capacity;
+	}
+
+	inline std::size_t
+	available() const
+	{
+		return free_list.size();
+	}
+
+public:
+	/**
+	 * Buffer which goes back to its pool when it goes out of scope.
+	 */
+	class
+	buffer
+		: private boost::noncopyable
+	{
+	public:
+		buffer(pool &_owner)
+			: owner(_owner), buf(owner.acquire())
+		{
+		}
+
+		~buffer()
+		{
+			owner.release(buf);
+		}
+
+		inline span<T>
+		get() const
+		{
+			return buf;
+		}
+
+		inline T *
+		data() const
+		{
+			return buf.data();
+		}
+
+		inline std::size_t
+		size() const
+		{
+			return buf.size();
+		}
+
+	private:
+		pool &owner;
+		span<T> buf;
+
+	};
+
+private:
+	std::vector<T> storage;
+	std::vector<T *> free_list;
+	std::vector<bool> in_use;
+	const std::size_t buffer_capacity;
+
+};
+
+/**
+ * Lock-free single-producer single-consumer ring.
+ *
+ * Exactly one thread may push and exactly one thread may pop. Besides
+ * push() and pop(), back()/commit() and front()/pop() let both sides work
+ * on the slots in place, without copying.
+ */
+template <class T> class
+ring
+	: private boost::noncopyable
+{
+public:
+	/**
+	 * @param capacity Number of slots, rounded up to a power of two.
+	 */
+	ring(std::size_t capacity)
+		: head(0), tail(0)
+	{
+		if (capacity == 0)
+			throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+		std::size_t n = 1;
+		while (n < capacity)
+			n <<= 1;
+
+		slots.resize(n);
+		mask = n - 1;
+	}
+
+	// Producer side.
+public:
+	/**
+	 * Returns the slot the next commit() publishes, or NULL if the ring
+	 * is full.
+	 */
+	T *
+	back()
+	{
+		const std::size_t t = tail;
+		if (t - head > mask)
+			return NULL;
+		// Don't touch the slot before the consumer is done with it.
+		__sync_synchronize();
+		return &slots[t & mask];
+	}
+
+	void
+	commit()
+	{
+		// Publish the slot contents before the new tail.
+		__sync_synchronize();
+		tail = tail + 1;
+	}
+
+	bool
+	push(const T &value)
+	{
+		T *slot = back();
+		if (slot == NULL)
+			return false;
+		*slot = value;
+		commit();
+		return true;
+	}
+
+	// Consumer side.
+public:
+	/**
+	 * Returns the oldest slot, or NULL if the ring is empty.
+	 */
+	T *
+	front()
+	{
+		const std::size_t h = head;
+		if (tail == h)
+			return NULL;
+		// Don't read the slot before seeing the tail that published it.
+		__sync_synchronize();
+		return &slots[h & mask];
+	}
+
+	void
+	pop()
+	{
+		// Finish reading the slot before handing it back.
+		__sync_synchronize();
+		head = head + 1;
+	}
+
+	bool
+	pop(T &value)
+	{
+		T *slot = front();
+		if (slot == NULL)
+			return false;
+		value = *slot;
+		pop();
+		return true;
+	}
+
+public:
+	inline std::size_t
+	size() const
+	{
+		return tail - head;
+	}
+
+	inline bool
+	empty() const
+	{
+		return tail == head;
+	}
+
+	inline std::size_t
+	get_capacity() const
+	{
+		return mask + 1;
+	}
+
+private:
+	std::vector<T> slots;
+	std::size_t mask;
+
+	volatile std::size_t head;	///< Written by the consumer only.
+	volatile std::size_t tail;	///< Written by the producer only.
+
+};
+
+}
+}
+
+#endif // !defined(_TSXX_BUFFERS_HPP_)
@@ -109,6 +109,27 @@ private:
 
 };
 
+class
+timeout
+: public exception
+{
+public:
+	timeout()
+		: message("timeout")
+	{
+	}
+
+	virtual const char *
+	what() const throw()
+	{
+		return message;
+	}
+
+private:
+	const char * const message;
+
+};
+
 class
 not_enough_memory
 : public exception
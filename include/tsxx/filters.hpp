@@ -0,0 +1,161 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#if !defined(_TSXX_FILTERS_HPP_)
+#define _TSXX_FILTERS_HPP_
+
+#include <tsxx/exceptions.hpp>
+
+namespace tsxx
+{
+namespace filters
+{
+
+/**
+ * Debounces all the pins of a port word at once with vertical counters:
+ * bit k of every pin's counter is kept in counter[k], so each tick costs a
+ * handful of word operations whatever the number of pins.
+ *
+ * A pin's debounced state changes once it has read the opposite level for
+ * its threshold of consecutive ticks.
+ *
+ * @param Word Port word type (e.g. uint8_t for dio1 or xdio).
+ * @param Bits Counter width; thresholds go from 1 to 2^Bits - 1.
+ */
+template <class Word, unsigned int Bits = 4> class
+debouncer
+{
+public:
+	enum { MAX_THRESHOLD = (1 << Bits) - 1 };
+
+	debouncer(Word initial = 0, unsigned int threshold = 4)
+		: state(initial), rising(0), falling(0)
+	{
+		for (unsigned int k = 0; k < Bits; k++)
+			counter[k] = limit[k] = 0;
+		set_threshold(~Word(0), threshold);
+	}
+
+	/**
+	 * Sets the number of consecutive ticks the pins in mask must hold a
+	 * new level before it is taken.
+	 */
+	void
+	set_threshold(Word mask, unsigned int threshold)
+	{
+		if (threshold < 1 || threshold > MAX_THRESHOLD)
+			throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+		for (unsigned int k = 0; k < Bits; k++) {
+			if (threshold & (1 << k))
+				limit[k] |= mask;
+			else
+				limit[k] &= ~mask;
+			counter[k] &= ~mask;
+		}
+	}
+
+	/**
+	 * Feeds a raw port reading.
+	 *
+	 * @return The debounced word.
+	 */
+	Word
+	update(Word sample)
+	{
+		const Word delta = sample ^ state;
+		Word carry = delta, reached = delta;
+
+		// Pins back at their debounced level restart from zero, the
+		// others count one more tick.
+		for (unsigned int k = 0; k < Bits; k++) {
+			const Word c = counter[k] & delta;
+			counter[k] = c ^ carry;
+			carry &= c;
+			reached &= ~(counter[k] ^ limit[k]);
+		}
+
+		for (unsigned int k = 0; k < Bits; k++)
+			counter[k] &= ~reached;
+
+		state ^= reached;
+		rising = reached & state;
+		falling = reached & ~state;
+
+		return state;
+	}
+
+	/**
+	 * Reads the port once and feeds it.
+	 */
+	template <class WordPort> Word
+	update_from(WordPort &port)
+	{
+		return update(port.read());
+	}
+
+	inline Word
+	get_state() const
+	{
+		return state;
+	}
+
+	/**
+	 * Pins which went high on the last update.
+	 */
+	inline Word
+	get_rising() const
+	{
+		return rising;
+	}
+
+	/**
+	 * Pins which went low on the last update.
+	 */
+	inline Word
+	get_falling() const
+	{
+		return falling;
+	}
+
+private:
+	Word counter[Bits];
+	Word limit[Bits];
+
+	Word state;
+	Word rising;
+	Word falling;
+
+};
+
+}
+}
+
+#endif // !defined(_TSXX_FILTERS_HPP_)
@@ -0,0 +1,493 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#if !defined(_TSXX_PROTOCOLS_HPP_)
+#define _TSXX_PROTOCOLS_HPP_
+
+#include <errno.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <tsxx/exceptions.hpp>
+#include <tsxx/utils.hpp>
+
+namespace tsxx
+{
+namespace protocols
+{
+
+/**
+ * Bit-banged I2C master over two pins of a DioPort (a dioport, dio1,
+ * xdio...).
+ *
+ * The lines are driven open-drain: a line is pulled low by clearing its
+ * output latch and making its pin an output, or released by making it an
+ * input. Slaves may stretch the clock. Timing comes from
+ * tsxx::utils::cpu::nssleep(), so cpu::calibrate() should have been called
+ * first.
+ *
+ * Address NACKs are reported as stdio_error(ENXIO) and data NACKs as
+ * stdio_error(EIO), like the kernel i2c-dev does.
+ */
+template <class DioPort> class
+i2c_master
+	: private boost::noncopyable
+{
+public:
+	typedef typename DioPort::word_type word_type;
+
+	enum {
+		STANDARD_MODE = 100000,
+		FAST_MODE = 400000,
+	};
+
+	/**
+	 * @param stretch_timeout_us Longest a slave may hold the clock low.
+	 */
+	i2c_master(DioPort &_port, unsigned int scl_bit, unsigned int sda_bit,
+			unsigned long hz = STANDARD_MODE,
+			unsigned long _stretch_timeout_us = 10000)
+		: port(_port), scl(word_type(1) << scl_bit), sda(word_type(1) << sda_bit),
+		stretch_timeout_us(_stretch_timeout_us)
+	{
+		set_rate(hz);
+
+		release(scl | sda);
+		port.write(port.read() & ~(scl | sda));
+	}
+
+	/**
+	 * Sets the SCL frequency. The low part of the period is a bit longer
+	 * than the high one, as the I2C minimum times are.
+	 */
+	void
+	set_rate(unsigned long hz)
+	{
+		if (hz == 0 || hz > 1000000)
+			throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+		const unsigned long period = 1000000000ul / hz;
+		t_low = period * 13 / 25;
+		t_high = period - t_low;
+	}
+
+	/**
+	 * @return true if a slave acknowledges the address.
+	 */
+	bool
+	probe(uint8_t addr)
+	{
+		start();
+		bool ack = write_byte(addr << 1);
+		stop();
+
+		return ack;
+	}
+
+	void
+	write(uint8_t addr, const uint8_t *p, std::size_t n)
+	{
+		start();
+		address(addr, false);
+		write_bytes(p, n);
+		stop();
+	}
+
+	void
+	read(uint8_t addr, uint8_t *p, std::size_t n)
+	{
+		start();
+		address(addr, true);
+		read_bytes(p, n);
+		stop();
+	}
+
+	/**
+	 * Writes then reads with a repeated start in between.
+	 */
+	void
+	write_read(uint8_t addr, const uint8_t *wrp, std::size_t wrn, uint8_t *rdp, std::size_t rdn)
+	{
+		start();
+		address(addr, false);
+		write_bytes(wrp, wrn);
+		start();
+		address(addr, true);
+		read_bytes(rdp, rdn);
+		stop();
+	}
+
+	/**
+	 * Writes a block to the registers of a device, starting at reg.
+	 */
+	void
+	write_reg(uint8_t addr, uint8_t reg, const uint8_t *p, std::size_t n)
+	{
+		start();
+		address(addr, false);
+		write_bytes(&reg, 1);
+		write_bytes(p, n);
+		stop();
+	}
+
+	/**
+	 * Reads a block from the registers of a device, starting at reg.
+	 */
+	void
+	read_reg(uint8_t addr, uint8_t reg, uint8_t *p, std::size_t n)
+	{
+		write_read(addr, &reg, 1, p, n);
+	}
+
+	/**
+	 * Frees a bus left stuck by a slave in the middle of a byte, by
+	 * clocking until it releases SDA.
+	 */
+	void
+	recover()
+	{
+		release(sda);
+		for (unsigned int i = 0; i < 9 && !sense(sda); i++) {
+			drive_low(scl);
+			delay(t_low);
+			release_scl();
+			delay(t_high);
+		}
+		drive_low(scl);
+		delay(t_low);
+		stop();
+	}
+
+private:
+	/**
+	 * The latches are cleared every time: a read-modify-write of the
+	 * port by someone else (e.g. a bitport on another pin) copies the
+	 * high level of a released line back into its latch.
+	 */
+	inline void
+	drive_low(word_type lines)
+	{
+		port.write(port.read() & ~lines);
+		port.set_dir(port.get_dir() | lines);
+	}
+
+	inline void
+	release(word_type lines)
+	{
+		port.set_dir(port.get_dir() & ~lines);
+	}
+
+	inline bool
+	sense(word_type line)
+	{
+		return (port.read() & line) != 0;
+	}
+
+	static inline void
+	delay(unsigned long ns)
+	{
+		tsxx::utils::cpu::nssleep(ns);
+	}
+
+	void
+	release_scl()
+	{
+		enum { STRETCH_POLL_NS = 1000 };
+
+		release(scl);
+
+		unsigned long waited = 0;
+		while (!sense(scl)) {
+			if (waited / 1000 >= stretch_timeout_us)
+				throw tsxx::exceptions::timeout();
+			delay(STRETCH_POLL_NS);
+			waited += STRETCH_POLL_NS;
+		}
+	}
+
+	/**
+	 * Start or, with SCL low, repeated start condition.
+	 */
+	void
+	start()
+	{
+		release(sda);
+		delay(t_low);
+		release_scl();
+		delay(t_high);
+		drive_low(sda);
+		delay(t_high);
+		drive_low(scl);
+	}
+
+	void
+	stop()
+	{
+		drive_low(sda);
+		delay(t_low);
+		release_scl();
+		delay(t_high);
+		release(sda);
+		delay(t_low);
+	}
+
+	void
+	write_bit(bool bit)
+	{
+		if (bit)
+			release(sda);
+		else
+			drive_low(sda);
+		delay(t_low);
+		release_scl();
+		delay(t_high);
+		drive_low(scl);
+	}
+
+	bool
+	read_bit()
+	{
+		release(sda);
+		delay(t_low);
+		release_scl();
+		delay(t_high);
+		bool bit = sense(sda);
+		drive_low(scl);
+
+		return bit;
+	}
+
+	/**
+	 * @return true if the byte was acknowledged.
+	 */
+	bool
+	write_byte(uint8_t byte)
+	{
+		for (int i = 7; i >= 0; i--)
+			write_bit((byte >> i) & 1);
+
+		return !read_bit();
+	}
+
+	uint8_t
+	read_byte(bool ack)
+	{
+		uint8_t byte = 0;
+
+		for (unsigned int i = 0; i < 8; i++)
+			byte = (byte << 1) | read_bit();
+		write_bit(!ack);
+
+		return byte;
+	}
+
+	void
+	address(uint8_t addr, bool reading)
+	{
+		if (!write_byte((addr << 1) | (reading ? 1 : 0))) {
+			stop();
+			throw tsxx::exceptions::stdio_error(ENXIO);
+		}
+	}
+
+	void
+	write_bytes(const uint8_t *p, std::size_t n)
+	{
+		for (std::size_t i = 0; i < n; i++) {
+			if (!write_byte(p[i])) {
+				stop();
+				throw tsxx::exceptions::stdio_error(EIO);
+			}
+		}
+	}
+
+	void
+	read_bytes(uint8_t *p, std::size_t n)
+	{
+		// The last byte is NACKed to end the read.
+		for (std::size_t i = 0; i < n; i++)
+			p[i] = read_byte(i + 1 < n);
+	}
+
+private:
+	DioPort &port;
+	const word_type scl;
+	const word_type sda;
+
+	unsigned long t_low;
+	unsigned long t_high;
+	const unsigned long stretch_timeout_us;
+
+};
+
+/**
+ * Bit-sliced software SPI transmitter: up to 8 chips with a shared clock
+ * and a data pin each, all loaded in a single pass.
+ *
+ * The byte streams are transposed 8x8 bits at a time into port words,
+ * each word carrying one bit of every stream, so every clock cycle costs
+ * the same whatever the number of chips. Data changes with the clock low
+ * and is taken on the rising edge (SPI mode 0). Chip selects, if any, are
+ * up to the caller.
+ */
+template <class DioPort> class
+parallel_spi
+	: private boost::noncopyable
+{
+public:
+	typedef typename DioPort::word_type word_type;
+
+	enum { MAX_STREAMS = 8 };
+
+	/**
+	 * @param data_bits Data pin of each stream.
+	 * @param _half_period_ns Clock high and low time, 0 to go as fast as
+	 * the port allows.
+	 */
+	parallel_spi(DioPort &_port, unsigned int clk_bit, const unsigned int *data_bits,
+			std::size_t _nstreams, unsigned long _half_period_ns = 0)
+		: port(_port), clk(word_type(1) << clk_bit), data_mask(0),
+		nstreams(_nstreams), half_period_ns(_half_period_ns)
+	{
+		if (nstreams == 0 || nstreams > MAX_STREAMS)
+			throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+		word_type pins[MAX_STREAMS];
+		for (std::size_t i = 0; i < nstreams; i++) {
+			pins[i] = word_type(1) << data_bits[i];
+			data_mask |= pins[i];
+		}
+
+		for (unsigned int v = 0; v < 256; v++) {
+			word_type w = 0;
+			for (std::size_t i = 0; i < nstreams; i++)
+				if (v & (1 << i))
+					w |= pins[i];
+			lut[v] = w;
+		}
+
+		port.write(port.read() & ~(clk | data_mask));
+		port.set_dir(port.get_dir() | clk | data_mask);
+	}
+
+	/**
+	 * Transposes len bytes of every stream into len * 8 port words,
+	 * most significant bits first.
+	 */
+	void
+	prepare(const uint8_t *const *streams, std::size_t len, word_type *words) const
+	{
+		for (std::size_t j = 0; j < len; j++) {
+			uint64_t x = 0;
+			for (std::size_t i = 0; i < nstreams; i++)
+				x |= static_cast<uint64_t>(streams[i][j]) << (8 * i);
+
+			x = transpose8(x);
+
+			// Byte b of x now holds bit b of every stream.
+			for (int b = 7; b >= 0; b--)
+				*words++ = lut[(x >> (8 * b)) & 0xff];
+		}
+	}
+
+	/**
+	 * Clocks out words made by prepare().
+	 */
+	void
+	send(const word_type *words, std::size_t n)
+	{
+		const word_type base = port.read() & ~(clk | data_mask);
+
+		for (std::size_t i = 0; i < n; i++) {
+			port.write(base | words[i]);
+			if (half_period_ns)
+				tsxx::utils::cpu::nssleep(half_period_ns);
+			port.write(base | words[i] | clk);
+			if (half_period_ns)
+				tsxx::utils::cpu::nssleep(half_period_ns);
+		}
+		port.write(base);
+	}
+
+	/**
+	 * Sends len bytes of every stream, transposing them in chunks on the
+	 * stack.
+	 */
+	void
+	transfer(const uint8_t *const *streams, std::size_t len)
+	{
+		enum { CHUNK = 16 };
+		word_type words[CHUNK * 8];
+		const uint8_t *chunk[MAX_STREAMS];
+
+		for (std::size_t off = 0; off < len; off += CHUNK) {
+			std::size_t n = len - off < CHUNK ? len - off : CHUNK;
+			for (std::size_t i = 0; i < nstreams; i++)
+				chunk[i] = streams[i] + off;
+			prepare(chunk, n, words);
+			send(words, n * 8);
+		}
+	}
+
+private:
+	/**
+	 * Transposes the 8x8 bit matrix whose rows are the bytes of x.
+	 */
+	static inline uint64_t
+	transpose8(uint64_t x)
+	{
+		uint64_t t;
+
+		t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaull;
+		x = x ^ t ^ (t << 7);
+		t = (x ^ (x >> 14)) & 0x0000cccc0000ccccull;
+		x = x ^ t ^ (t << 14);
+		t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ull;
+		x = x ^ t ^ (t << 28);
+
+		return x;
+	}
+
+private:
+	DioPort &port;
+	const word_type clk;
+	word_type data_mask;
+	const std::size_t nstreams;
+	const unsigned long half_period_ns;
+
+	/// Port word for each combination of stream bits.
+	word_type lut[256];
+
+};
+
+}
+}
+
+#endif // !defined(_TSXX_PROTOCOLS_HPP_)
@@ -0,0 +1,415 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#if !defined(_TSXX_SIGNALS_HPP_)
+#define _TSXX_SIGNALS_HPP_
+
+#include <ostream>
+
+#include <boost/noncopyable.hpp>
+
+#include <tsxx/buffers.hpp>
+
+namespace tsxx
+{
+namespace signals
+{
+
+/**
+ * Logic analyzer: samples a WordPort (a dioport, dio1, xdio...) as fast as
+ * possible and stores only its transitions, timestamped with a free
+ * running Clock (e.g. ts7300::devices::timer).
+ *
+ * The sampling loop doesn't allocate: the transition ring is sized up
+ * front and the capture stops when it fills up.
+ */
+template <class WordPort, class Clock> class
+capture
+	: private boost::noncopyable
+{
+public:
+	typedef typename WordPort::word_type word_type;
+
+	struct transition
+	{
+		/// Clock ticks since the start of the capture.
+		uint32_t timestamp;
+		word_type value;
+	};
+
+	/**
+	 * @param depth Most transitions kept by a capture.
+	 * @param _mask Pins whose transitions are recorded.
+	 */
+	capture(WordPort &_port, Clock &_clock, unsigned long _ticks_per_second,
+			std::size_t depth, word_type _mask = ~word_type(0))
+		: port(_port), clock(_clock), ticks_per_second(_ticks_per_second),
+		mask(_mask), transitions(depth), initial(0), samples(0), elapsed(0),
+		overflowed(false)
+	{
+	}
+
+	/**
+	 * Samples the port for duration ticks of the clock.
+	 *
+	 * @return false if the ring filled up before the end.
+	 */
+	bool
+	run(uint32_t duration)
+	{
+		// The clock is only read on transitions and every CHECK_PERIOD
+		// samples, which keeps the loop close to one port read per sample.
+		enum { CHECK_PERIOD = 64 };
+
+		while (!transitions.empty())
+			transitions.pop();
+		overflowed = false;
+
+		word_type last = port.read() & mask;
+		const uint32_t start = clock.read();
+		uint32_t now = start;
+		unsigned long n = 1;
+
+		initial = last;
+
+		for (;;) {
+			word_type v = port.read() & mask;
+			n++;
+
+			if (v != last) {
+				now = clock.read();
+				transition *slot = transitions.back();
+				if (slot == NULL) {
+					overflowed = true;
+					break;
+				}
+				slot->timestamp = now - start;
+				slot->value = v;
+				transitions.commit();
+				last = v;
+			} else if (n % CHECK_PERIOD == 0) {
+				now = clock.read();
+			} else {
+				continue;
+			}
+
+			if (now - start >= duration)
+				break;
+		}
+
+		samples = n;
+		elapsed = now - start;
+
+		return !overflowed;
+	}
+
+	/**
+	 * Sampling rate achieved by the last capture, in Hz.
+	 */
+	inline double
+	get_rate() const
+	{
+		return elapsed ? static_cast<double>(samples) * ticks_per_second / elapsed : 0;
+	}
+
+	inline unsigned long
+	get_samples() const
+	{
+		return samples;
+	}
+
+	inline bool
+	has_overflowed() const
+	{
+		return overflowed;
+	}
+
+	inline word_type
+	get_initial() const
+	{
+		return initial;
+	}
+
+	/**
+	 * Transitions of the last capture, oldest first.
+	 */
+	inline tsxx::buffers::ring<transition> &
+	get_transitions()
+	{
+		return transitions;
+	}
+
+	/**
+	 * Writes the last capture as a VCD file with one wire per pin,
+	 * consuming its transitions.
+	 */
+	void
+	write_vcd(std::ostream &os, const char *name = "port")
+	{
+		const unsigned int width = sizeof(word_type) * 8;
+
+		os << "$timescale 1 ns $end" << std::endl;
+		os << "$scope module " << name << " $end" << std::endl;
+		for (unsigned int i = 0; i < width; i++)
+			if (mask & (word_type(1) << i))
+				os << "$var wire 1 " << id(i) << " " << name << i << " $end" << std::endl;
+		os << "$upscope $end" << std::endl;
+		os << "$enddefinitions $end" << std::endl;
+
+		os << "#0" << std::endl << "$dumpvars" << std::endl;
+		dump(os, initial, mask);
+		os << "$end" << std::endl;
+
+		word_type last = initial;
+		transition t;
+		while (transitions.pop(t)) {
+			os << "#" << static_cast<unsigned long long>(t.timestamp) * 1000000000ull / ticks_per_second << std::endl;
+			dump(os, t.value, t.value ^ last);
+			last = t.value;
+		}
+		os << "#" << static_cast<unsigned long long>(elapsed) * 1000000000ull / ticks_per_second << std::endl;
+	}
+
+private:
+	static inline char
+	id(unsigned int bit)
+	{
+		return static_cast<char>('!' + bit);
+	}
+
+	static void
+	dump(std::ostream &os, word_type value, word_type changed)
+	{
+		for (unsigned int i = 0; i < sizeof(word_type) * 8; i++)
+			if (changed & (word_type(1) << i))
+				os << ((value >> i) & 1) << id(i) << std::endl;
+	}
+
+private:
+	WordPort &port;
+	Clock &clock;
+	const unsigned long ticks_per_second;
+	const word_type mask;
+
+	tsxx::buffers::ring<transition> transitions;
+
+	word_type initial;
+	unsigned long samples;
+	uint32_t elapsed;
+	bool overflowed;
+
+};
+
+/**
+ * Writes precomputed port words (DAC samples, stepper phases...) to a
+ * WordPort at a fixed rate, paced by a free running Clock.
+ *
+ * A producer thread queues buffers with submit() and gets them back with
+ * reclaim() once sent, while run() streams them from another thread: with
+ * two buffers one is refilled while the other is sent. Samples are
+ * scheduled on absolute clock deadlines, so a late sample doesn't shift
+ * the following ones.
+ */
+template <class WordPort, class Clock> class
+streamer
+	: private boost::noncopyable
+{
+public:
+	typedef typename WordPort::word_type word_type;
+
+	/**
+	 * @param _period Clock ticks between samples.
+	 * @param _mask Pins written; the others keep their values.
+	 * @param depth Most buffers queued at once.
+	 */
+	streamer(WordPort &_port, Clock &_clock, uint32_t _period,
+			word_type _mask = ~word_type(0), std::size_t depth = 2)
+		: port(_port), clock(_clock), period(_period), mask(_mask),
+		pending(depth), done(depth), outstanding(0), limit(depth), stopping(false),
+		emitted(0), underruns(0), late(0)
+	{
+		if (period == 0)
+			throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+	}
+
+	// Producer side.
+public:
+	/**
+	 * Queues n words. The buffer must stay untouched until reclaim()
+	 * returns it.
+	 *
+	 * @return false if depth buffers are already outstanding (queued or
+	 * sent but not reclaimed yet).
+	 */
+	bool
+	submit(const word_type *words, std::size_t n)
+	{
+		block b = { words, n };
+
+		if (outstanding >= limit || !pending.push(b))
+			return false;
+		outstanding++;
+
+		return true;
+	}
+
+	/**
+	 * @return A buffer which has been sent, or NULL.
+	 */
+	const word_type *
+	reclaim()
+	{
+		const word_type *words;
+
+		if (!done.pop(words))
+			return NULL;
+		outstanding--;
+
+		return words;
+	}
+
+	// Streaming side.
+public:
+	/**
+	 * Streams the queued buffers.
+	 *
+	 * @param until_empty Return once the queue is empty. Otherwise the
+	 * output is held and every sample slot passing without data counts
+	 * as an underrun, until stop() is called.
+	 */
+	void
+	run(bool until_empty = true)
+	{
+		const bool masked = mask != word_type(~word_type(0));
+		uint32_t next = clock.read() + period;
+
+		stopping = false;
+		while (!stopping) {
+			block *b = pending.front();
+			if (b == NULL) {
+				if (until_empty)
+					break;
+				wait_until(next);
+				underruns = underruns + 1;
+				next += period;
+				continue;
+			}
+
+			const word_type base = masked ? (port.read() & ~mask) : 0;
+			for (std::size_t i = 0; i < b->n; i++) {
+				const uint32_t now = wait_until(next);
+				port.write(masked ? (base | (b->words[i] & mask)) : b->words[i]);
+				if (now - next >= period)
+					late = late + 1;
+				next += period;
+			}
+			emitted = emitted + b->n;
+
+			const word_type *words = b->words;
+			pending.pop();
+			// Can't fail: submit() bounds the outstanding buffers to
+			// the capacity of done.
+			done.push(words);
+		}
+	}
+
+	/**
+	 * Makes run() return after the buffer being sent.
+	 */
+	inline void
+	stop()
+	{
+		stopping = true;
+	}
+
+	inline unsigned long
+	get_emitted() const
+	{
+		return emitted;
+	}
+
+	/**
+	 * Sample slots missed because no buffer was queued.
+	 */
+	inline unsigned long
+	get_underruns() const
+	{
+		return underruns;
+	}
+
+	/**
+	 * Samples written a whole period or more after their deadline.
+	 */
+	inline unsigned long
+	get_late() const
+	{
+		return late;
+	}
+
+private:
+	struct block
+	{
+		const word_type *words;
+		std::size_t n;
+	};
+
+	inline uint32_t
+	wait_until(uint32_t deadline)
+	{
+		uint32_t now;
+
+		while (static_cast<int32_t>((now = clock.read()) - deadline) < 0)
+			;
+
+		return now;
+	}
+
+private:
+	WordPort &port;
+	Clock &clock;
+	const uint32_t period;
+	const word_type mask;
+
+	tsxx::buffers::ring<block> pending;
+	tsxx::buffers::ring<const word_type *> done;
+	std::size_t outstanding;	///< Producer side only.
+	const std::size_t limit;
+
+	volatile bool stopping;
+	volatile unsigned long emitted;
+	volatile unsigned long underruns;
+	volatile unsigned long late;
+
+};
+
+}
+}
+
+#endif // !defined(_TSXX_SIGNALS_HPP_)
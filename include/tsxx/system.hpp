@@ -66,6 +66,29 @@ private:
 };
 typedef boost::shared_ptr<file_descriptor> file_descriptor_ptr;
 
+/**
+ * Interrupt notifications of a UIO device (/dev/uioN), or of an eventfd
+ * standing in for one.
+ */
+class
+uio_device
+: private boost::noncopyable
+{
+public:
+	uio_device();
+
+	void attach(file_descriptor_ptr fd);
+
+	bool wait(int timeout_ms);
+	void rearm();
+
+private:
+	file_descriptor_ptr fd;
+	std::size_t read_size;
+	bool rearmable;
+
+};
+
 class
 memory_region
 : private boost::noncopyable
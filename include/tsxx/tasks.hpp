@@ -0,0 +1,156 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#if !defined(_TSXX_TASKS_HPP_)
+#define _TSXX_TASKS_HPP_
+
+#include <unistd.h>
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace tsxx
+{
+namespace tasks
+{
+
+/**
+ * Resumable operation: a device wait or transfer which makes progress in
+ * small non-blocking steps, so one thread can drive many devices.
+ */
+class
+task
+{
+public:
+	virtual
+	~task()
+	{
+	}
+
+	/**
+	 * Makes as much progress as possible without blocking.
+	 *
+	 * @return true once the task has finished.
+	 */
+	virtual bool poll() = 0;
+
+};
+
+/**
+ * Single-threaded cooperative scheduler: polls every pending task in
+ * turn, so while one device is busy the others keep going.
+ */
+class
+scheduler
+	: private boost::noncopyable
+{
+public:
+	void
+	add(task &t)
+	{
+		pending.push_back(&t);
+	}
+
+	/**
+	 * Polls each pending task once, dropping the finished ones.
+	 *
+	 * @return true while there are pending tasks.
+	 */
+	bool
+	run_once()
+	{
+		std::size_t i = 0;
+
+		while (i < pending.size()) {
+			if (pending[i]->poll()) {
+				pending[i] = pending.back();
+				pending.pop_back();
+			} else {
+				i++;
+			}
+		}
+
+		return !pending.empty();
+	}
+
+	/**
+	 * Runs until all tasks have finished.
+	 *
+	 * @param idle_us Sleep between rounds, 0 to keep polling.
+	 */
+	void
+	run(unsigned int idle_us = 0)
+	{
+		while (run_once())
+			if (idle_us > 0)
+				usleep(idle_us);
+	}
+
+	inline bool
+	empty() const
+	{
+		return pending.empty();
+	}
+
+private:
+	std::vector<task *> pending;
+
+};
+
+/**
+ * Waits for a bit of a port (e.g. a bitport) to reach a state.
+ */
+template <class BitPort> class
+bit_wait
+	: public task
+{
+public:
+	bit_wait(BitPort &_bit, bool _state)
+		: bit(_bit), state(_state)
+	{
+	}
+
+	bool
+	poll()
+	{
+		return bit.get() == state;
+	}
+
+private:
+	BitPort &bit;
+	const bool state;
+
+};
+
+}
+}
+
+#endif // !defined(_TSXX_TASKS_HPP_)
@@ -41,6 +41,16 @@ namespace ts7300
 class
 board
 {
+public:
+	/**
+	 * Chip select of the boot EEPROM on the SPI bus. It must always be
+	 * kept de-asserted, see init().
+	 */
+	enum {
+		EEPROM_CS_ADDR = 0x23000000,
+		EEPROM_CS_BIT = 0,
+	};
+
 public:
 	board(tsxx::system::memory &mem);
 
@@ -51,6 +61,7 @@ public:
 	ts7300::devices::dio1 &get_dio1();
 	ts7300::devices::lcd &get_lcd();
 	ts7300::devices::spi &get_spi();
+	ts7300::devices::timer &get_timer();
 
 private:
 	tsxx::system::memory &memory;
@@ -60,6 +71,7 @@ private:
 	ts7300::devices::dio1 dio1;
 	ts7300::devices::lcd lcd;
 	ts7300::devices::spi spi;
+	ts7300::devices::timer timer;
 
 };
 
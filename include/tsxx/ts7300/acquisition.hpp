@@ -0,0 +1,184 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#if !defined(_TSXX_TS7300_ACQUISITION_HPP_)
+#define _TSXX_TS7300_ACQUISITION_HPP_
+
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <tsxx/buffers.hpp>
+#include <tsxx/ts7300/devices.hpp>
+
+namespace tsxx
+{
+namespace ts7300
+{
+
+/**
+ * Continuous acquisition from an SPI ADC.
+ *
+ * A sampling thread sends a fixed command frame to the chip at a fixed
+ * rate, paced by the hardware timer, and stores each reply together with
+ * the timer value it was taken at. Samples are grouped in blocks handed to
+ * one consumer thread through a lock-free ring; the consumer reads them in
+ * place and gives them back with pop().
+ *
+ * When the consumer falls behind, whole blocks are dropped and counted as
+ * overruns; when the sampler falls behind, it skips the missed sampling
+ * slots and counts them as late. A failed transfer (e.g. a bus timeout)
+ * ends the sampling thread and is reported through has_failed() and
+ * get_error().
+ */
+class
+acquisition
+	: private boost::noncopyable
+{
+public:
+	struct block
+	{
+		unsigned long sequence;		///< Block number, gaps are overruns.
+		std::size_t count;		///< Number of samples.
+		const uint32_t *timestamps;	///< Timer value of each sample.
+		const uint8_t *data;		///< count replies, one frame each.
+	};
+
+public:
+	/**
+	 * @param frame Command frame sent for each sample; replies have the
+	 * same size.
+	 * @param rate_hz Sampling rate.
+	 * @param block_samples Samples per block.
+	 * @param nblocks Blocks in the ring (rounded up to a power of two).
+	 */
+	acquisition(devices::spi_chip &chip, devices::timer &tmr, const std::vector<uint8_t> &frame,
+			unsigned long rate_hz, std::size_t block_samples, std::size_t nblocks);
+	~acquisition();
+
+	/**
+	 * @param rt_priority SCHED_FIFO priority of the sampling thread, 0
+	 * to keep the default scheduling.
+	 */
+	void start(int rt_priority = 0);
+	void stop();
+
+	// Consumer side.
+public:
+	/**
+	 * Returns the oldest filled block, or NULL if none.
+	 */
+	inline const block *
+	front()
+	{
+		return blocks.front();
+	}
+
+	inline void
+	pop()
+	{
+		blocks.pop();
+	}
+
+public:
+	inline unsigned long
+	get_samples() const
+	{
+		return samples;
+	}
+
+	inline unsigned long
+	get_overruns() const
+	{
+		return overruns;
+	}
+
+	inline unsigned long
+	get_late() const
+	{
+		return late;
+	}
+
+	inline std::size_t
+	get_frame_size() const
+	{
+		return frame.size();
+	}
+
+	inline bool
+	has_failed() const
+	{
+		return failed;
+	}
+
+	/**
+	 * Why the sampling thread stopped, once has_failed().
+	 */
+	inline const std::string &
+	get_error() const
+	{
+		return error;
+	}
+
+private:
+	static void *thread_main(void *arg);
+	void loop();
+
+private:
+	devices::spi_chip &chip;
+	devices::timer &tmr;
+	const std::vector<uint8_t> frame;
+	const uint32_t period;
+	const std::size_t block_samples;
+
+	tsxx::buffers::ring<block> blocks;
+	/// Blocks ever committed, i.e. the ring's tail, kept across restarts.
+	unsigned long committed;
+	std::vector<uint32_t> timestamps;
+	std::vector<uint8_t> data;
+
+	pthread_t thread;
+	bool started;
+	volatile bool stopping;
+
+	volatile unsigned long samples, overruns, late;
+
+	volatile bool failed;
+	std::string error;
+
+};
+
+}
+}
+
+#endif // !defined(_TSXX_TS7300_ACQUISITION_HPP_)
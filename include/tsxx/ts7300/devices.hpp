@@ -31,9 +31,15 @@
 #if !defined(_TSXX_TS7300_DEVICES_HPP_)
 #define _TSXX_TS7300_DEVICES_HPP_
 
+#include <pthread.h>
+#include <sched.h>
+
+#include <iosfwd>
 #include <vector>
 
+#include <tsxx/buffers.hpp>
 #include <tsxx/ports.hpp>
+#include <tsxx/tasks.hpp>
 
 namespace tsxx
 {
@@ -102,6 +108,172 @@ private:
 
 };
 
+/**
+ * Edge interrupts of the EP93xx GPIO ports A, B and F (DIO1 lives on
+ * ports B and F).
+ *
+ * Interrupts are delivered to user space through an event fd. Threads
+ * sleep in wait() or poll the fd themselves (get_fd()) until an edge
+ * arrives.
+ *
+ * With a UIO device (SOURCE_UIO), or an eventfd standing in for it in
+ * tests, the interrupt controller is programmed through /dev/mem.
+ *
+ * With a sysfs-gpio value file (SOURCE_SYSFS), the kernel owns the
+ * interrupt registers and the file's edge must be set to "both": the
+ * edges are told from the levels read from the file, one pin per fd.
+ */
+class
+gpio_irq
+	: public tsxx::tasks::task, private boost::noncopyable
+{
+private:
+	enum { BASE_ADDR = 0x80840000 };
+public:
+	enum port_id {
+		PORT_A,
+		PORT_B,
+		PORT_F,
+	};
+
+	enum source_type {
+		SOURCE_UIO,
+		SOURCE_SYSFS,
+	};
+
+	enum edge {
+		EDGE_FALLING,
+		EDGE_RISING,
+		/// Emulated by flipping the polarity on each edge.
+		EDGE_BOTH,
+	};
+
+	typedef tsxx::ports::port8::word_type word_type;
+
+	gpio_irq(tsxx::system::memory &memory, port_id port);
+	~gpio_irq();
+
+	/**
+	 * Must be called before enable().
+	 *
+	 * @param bit Pin of a SOURCE_SYSFS value file.
+	 */
+	void attach(tsxx::system::file_descriptor_ptr fd, source_type type = SOURCE_UIO,
+			unsigned int bit = 0);
+
+	/**
+	 * Enables edge interrupts on the given pins.
+	 *
+	 * @param debounce Enables the hardware debounce of the pins (not
+	 * available with SOURCE_SYSFS).
+	 */
+	void enable(word_type mask, edge e, bool debounce = false);
+	void disable(word_type mask);
+
+	/**
+	 * Software debounce: edges of a pin closer than holdoff_us to its
+	 * last reported edge are dropped.
+	 */
+	inline void
+	set_holdoff(unsigned long holdoff_us)
+	{
+		holdoff_ns = static_cast<uint64_t>(holdoff_us) * 1000;
+	}
+
+	inline int
+	get_fd() const
+	{
+		return fd->get_value();
+	}
+
+	/**
+	 * Sleeps until an edge arrives.
+	 *
+	 * @param events Pins with edges since the last call.
+	 * @param timeout_ms -1 to wait for ever.
+	 * @return false on timeout.
+	 */
+	bool wait(word_type &events, int timeout_ms = -1);
+
+	/**
+	 * Handles pending interrupts without blocking.
+	 *
+	 * @return true once there are events, which are taken by get_events().
+	 */
+	bool poll();
+
+	inline word_type
+	get_events()
+	{
+		word_type e = pending;
+		pending = 0;
+		return e;
+	}
+
+private:
+	static unsigned long data_addr(port_id port);
+	static unsigned long irq_addr(port_id port, unsigned int offset);
+
+	bool handle(int timeout_ms);
+	bool read_level();
+
+private:
+	tsxx::ports::port8 data, type1, type2, eoi, enable_reg, status, debounce;
+
+	tsxx::system::file_descriptor_ptr fd;
+	source_type source;
+	tsxx::system::uio_device uio;
+
+	/// Pin and last level of a SOURCE_SYSFS value file.
+	word_type sysfs_pin;
+	bool sysfs_level;
+
+	word_type enabled;
+	word_type rising;
+	word_type falling;
+	word_type pending;
+
+	uint64_t holdoff_ns;
+	uint64_t last_edge[8];
+
+};
+
+/**
+ * Free running 32 bits hardware counter, used for timestamps and pacing.
+ */
+class
+timer
+{
+private:
+	enum { COUNTER_ADDR = 0x12000004 };
+public:
+	enum { TICKS_PER_SECOND = 14745600 };
+
+	timer(tsxx::system::memory &memory)
+		: counter(memory.get_region(COUNTER_ADDR))
+	{
+	}
+
+	inline uint32_t
+	read()
+	{
+		return counter.read();
+	}
+
+	/**
+	 * Number of ticks in a period given in nanoseconds.
+	 */
+	static inline uint32_t
+	ticks(unsigned long long ns)
+	{
+		return static_cast<uint32_t>(ns * TICKS_PER_SECOND / 1000000000ull);
+	}
+
+private:
+	tsxx::ports::port32 counter;
+
+};
+
 /**
  * LCD port class.
  */
@@ -128,6 +300,12 @@ private:
 		LCD_BIT_CTRL_DSP_OFF =		0x00,
 		LCD_BIT_CTRL_DSP_ON =		0x04,
 
+		LCD_CMD_SHIFT =			0x10,
+		LCD_BIT_SHIFT_CURSOR =		0x00,
+		LCD_BIT_SHIFT_DISPLAY =		0x08,
+		LCD_BIT_SHIFT_LEFT =		0x00,
+		LCD_BIT_SHIFT_RIGHT =		0x04,
+
 		LCD_CMD_FNSET =			0x20,
 		LCD_BIT_FNSET_FONT_5x8 =	0x00,
 		LCD_BIT_FNSET_FONT_5x11 =	0x04,
@@ -143,17 +321,56 @@ private:
 		LCD_VAL_DDRAM_ROW1 =		0x40,
 		LCD_VAL_DDRAM_ROW2 =		0x14,
 		LCD_VAL_DDRAM_ROW3 =		0x54,
+		LCD_VAL_DDRAM_LINE_LEN =	40,
+	};
+
+public:
+	/**
+	 * Custom character bitmap for the 5x8 font: one byte per row, only
+	 * the 5 least significant bits are used.
+	 */
+	struct glyph
+	{
+		uint8_t rows[8];
 	};
 
 public:
 	lcd(tsxx::system::memory &memory);
 
 	void init();
+	bool attach();
 	void print(std::string str);
 	void print(const void *p, std::size_t len);
+	void print(const glyph &g);
 	void command(uint8_t cmd);
 	bool wait();
 
+	uint8_t load_glyph(const glyph &g);
+	void invalidate_glyphs();
+
+	/**
+	 * Non-blocking wait(): each poll reads the busy flag once.
+	 */
+	class
+	async_wait
+		: public tsxx::tasks::task
+	{
+	public:
+		async_wait(lcd &_dev)
+			: dev(_dev)
+		{
+		}
+
+		bool poll();
+
+	private:
+		lcd &dev;
+
+	};
+
+	void marquee(const std::string &text, unsigned int row, unsigned int width);
+	void marquee_step();
+
 public:
 	void
 	clear()
@@ -186,6 +403,15 @@ public:
 		usleep(39);
 	}
 
+	void
+	shift(bool display, bool right)
+	{
+		command(LCD_CMD_SHIFT |
+				(display ? LCD_BIT_SHIFT_DISPLAY : LCD_BIT_SHIFT_CURSOR) |
+				(right ? LCD_BIT_SHIFT_RIGHT : LCD_BIT_SHIFT_LEFT));
+		usleep(39);
+	}
+
 	void
 	function(bool font_5x8, bool n2lines, bool dat8bit)
 	{
@@ -207,6 +433,18 @@ public:
 				x);
 	}
 
+	void
+	cgram(unsigned int addr)
+	{
+		command(LCD_CMD_CGRAM | (addr & 0x3f));
+	}
+
+private:
+	bool wait(uint8_t &address);
+	uint8_t read_status();
+
+	static uint32_t hash_glyph(const glyph &g);
+
 private:
 	// Referenced in the manual as Port A (data) and C (data7).
 	tsxx::ports::dioport<tsxx::ports::port8> data, data7;
@@ -217,12 +455,31 @@ private:
 	tsxx::ports::dioport<tsxx::ports::port8> ctrl;
 	const tsxx::ports::port8::word_type ctrl_bit_en, ctrl_bit_rs, ctrl_bit_wr;
 
+	// CGRAM glyph cache, one entry per custom character slot.
+	enum { GLYPH_SLOTS = 8 };
+	struct glyph_slot
+	{
+		bool used;
+		uint32_t hash;
+		unsigned long stamp;
+		glyph data;
+	} glyph_slots[GLYPH_SLOTS];
+	unsigned long glyph_clock;
+
+	// Marquee state: the text, where it is and what each DDRAM cell of
+	// the marquee row currently holds.
+	std::string marquee_text;
+	unsigned int marquee_row, marquee_width, marquee_pos, marquee_offset;
+	char marquee_cells[LCD_VAL_DDRAM_LINE_LEN];
+
 };
 
 /**
  * XDIO port class.
  *
- * The only implemented mode (yet) is DIO (GPIO) mode (set_mode_dio()).
+ * Implemented modes are DIO (GPIO, set_mode_dio()), PWM (set_mode_pwm()),
+ * edge/quadrature counter (set_mode_counter()) and input pulse timer
+ * (set_mode_pulse_timer()).
  */
 class
 xdio
@@ -246,12 +503,188 @@ private:
 		UNINITIALIZED,
 	} mode;
 
+	/// Mode specific bits of the configuration register.
+	tsxx::ports::port8::word_type conf_bits;
+
 	void read_conf();
 	void write_conf();
 
 	// Operation mode setting methods.
 public:
 	void set_mode_dio();
+	void set_mode_pwm(unsigned int prescaler);
+
+	enum counter_type {
+		COUNT_EDGES = 0x00,
+		COUNT_QUADRATURE = 0x01,
+	};
+
+	void set_mode_counter(counter_type type);
+	void set_mode_pulse_timer(unsigned int prescaler);
+
+	// PWM methods and variables.
+public:
+	/// PWM and pulse timer clock before the prescaler, in Hz.
+	enum { PWM_CLOCK = 75000000 };
+
+	/// Largest high or low time.
+	enum { PWM_MAX = 0x0fff };
+
+	/**
+	 * Clock of the PWM and pulse timer counts, in Hz.
+	 */
+	inline unsigned long
+	get_clock() const
+	{
+		return PWM_CLOCK >> (conf_bits & 0x0f);
+	}
+
+	/**
+	 * PWM waveform, in periods of the prescaled clock.
+	 */
+	struct pwm
+	{
+		uint16_t high;
+		uint16_t low;
+	};
+
+	/**
+	 * Splits a period in high and low times.
+	 *
+	 * @param duty High time, from 0 to period.
+	 */
+	static inline pwm
+	pwm_duty(uint16_t period, uint16_t duty)
+	{
+		if (duty > period || duty > PWM_MAX || period - duty > PWM_MAX)
+			throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+		pwm p = { duty, static_cast<uint16_t>(period - duty) };
+		return p;
+	}
+
+	void set_pwm(const pwm &p);
+	static void set_pwm(xdio *const *ports, const pwm *values, std::size_t n);
+
+	// Edge/quadrature counter methods.
+public:
+	uint16_t read_counter_raw();
+
+	/**
+	 * Reads the counter extended to 64 bits. Quadrature counts are
+	 * signed. It must be called at least once every 32768 counts, or
+	 * wraps are lost.
+	 */
+	int64_t read_counter();
+
+	/**
+	 * Makes the current position read as zero.
+	 */
+	void reset_counter();
+
+	/**
+	 * Counters of several ports sampled together.
+	 */
+	struct counter_snapshot
+	{
+		/// timer ticks at the middle of the sampling.
+		uint32_t timestamp;
+		int64_t counts[2];
+	};
+
+	static void read_counters(xdio *const *ports, std::size_t n, timer &t,
+			counter_snapshot &snap);
+
+	// Input pulse timer methods.
+public:
+	/**
+	 * Last measured input pulse, in get_clock() periods.
+	 */
+	struct pulse
+	{
+		uint16_t high;
+		uint16_t low;
+
+		inline unsigned int
+		period() const
+		{
+			return high + low;
+		}
+	};
+
+	/**
+	 * Reads the last measured pulse.
+	 *
+	 * @return false if there is no valid measurement: the input is not
+	 * toggling, or a time is saturated because the signal is too slow
+	 * for the prescaler.
+	 */
+	bool read_pulse(pulse &p);
+
+	/**
+	 * Pulse statistics over a window of measurements.
+	 */
+	struct pulse_stats
+	{
+		unsigned int count;
+		unsigned int invalid;
+		unsigned int min_period, max_period;
+		unsigned int min_high, max_high;
+		unsigned long long sum_period, sum_high;
+
+		pulse_stats()
+		{
+			reset();
+		}
+
+		inline void
+		reset()
+		{
+			count = invalid = 0;
+			min_period = min_high = ~0u;
+			max_period = max_high = 0;
+			sum_period = sum_high = 0;
+		}
+
+		inline void
+		add(const pulse &p)
+		{
+			unsigned int period = p.period();
+			if (period < min_period)
+				min_period = period;
+			if (period > max_period)
+				max_period = period;
+			if (p.high < min_high)
+				min_high = p.high;
+			if (p.high > max_high)
+				max_high = p.high;
+			sum_period += period;
+			sum_high += p.high;
+			count++;
+		}
+
+		inline double
+		mean_period() const
+		{
+			return count ? static_cast<double>(sum_period) / count : 0;
+		}
+
+		/**
+		 * Mean duty cycle, from 0 to 1.
+		 */
+		inline double
+		mean_duty() const
+		{
+			return sum_period ? static_cast<double>(sum_high) / sum_period : 0;
+		}
+	};
+
+	/**
+	 * Adds n readings to the statistics.
+	 *
+	 * @param interval_us Time between readings. It should be at least the
+	 * longest expected period, so each reading is a new measurement.
+	 */
+	void sample_pulses(pulse_stats &stats, unsigned int n, unsigned long interval_us = 0);
 
 	// DIO methods and variables.
 public:
@@ -280,25 +713,249 @@ public:
 		return get_dio().read();
 	}
 
+private:
+	struct pwm_regs
+	{
+		tsxx::ports::port8::word_type r1, r2, r3;
+	};
+
+	static pwm_regs encode_pwm(const pwm &p);
+	void read_regs(pwm_regs &r);
+	void write_pwm_low(const pwm_regs &r);
+	void write_pwm_latch(const pwm_regs &r);
+
+	int64_t extend_counter(uint16_t raw);
+
+	/// Last values written to reg1 and reg2 in PWM mode.
+	bool pwm_valid;
+	pwm_regs pwm_shadow;
+
+	/// Last raw counter value and its 64 bits extension.
+	uint16_t counter_last;
+	int64_t counter_total;
+
 private:
 	tsxx::ports::port8 conf, reg1, reg2, reg3;
 	tsxx::ports::dioport<tsxx::ports::port8> dio_port;
 
 };
 
+class spi_chip;
+
+/**
+ * SSP (SPI) controller.
+ *
+ * The bus is shared by threads through acquire()/release() or the
+ * scoped spi::lock. Waiting threads are served by priority, oldest first,
+ * except that a waiter passed over BYPASS_LIMIT times goes next, so low
+ * priority clients still make progress. While a thread with a real-time
+ * scheduling priority waits, the bus owner runs with that priority.
+ */
 class
 spi
+	: private boost::noncopyable
 {
 private:
 	enum { BASE_ADDR = 0x808a0000 };
+
+	enum { BYPASS_LIMIT = 4 };
+
+	enum {
+		SSPSR_TFE =	0x01,
+		SSPSR_TNF =	0x02,
+		SSPSR_RNE =	0x04,
+		SSPSR_RFF =	0x08,
+		SSPSR_BSY =	0x10,
+	};
+
+	enum {
+		SSPCR0_DSS_MASK =	0x000f,
+		SSPCR0_FRF_SPI =	0x0000,
+		SSPCR0_SPO =		0x0040,
+		SSPCR0_SPH =		0x0080,
+	};
+
+	/// Depth of both the TX and the RX FIFOs.
+	enum { FIFO_DEPTH = 8 };
+public:
+	/// SSP input clock, in Hz.
+	enum { SSPCLK = 7372800 };
+
+	/**
+	 * Bus clock, SPI mode and frame size of a chip. The bit rate is
+	 * SSPCLK / (prescaler * (1 + rate)).
+	 */
+	struct profile
+	{
+		uint8_t prescaler;	///< CPSDVSR, even number from 2 to 254.
+		uint8_t rate;		///< SCR, from 0 to 255.
+		bool cpol, cpha;
+		uint8_t bits;		///< Frame size, from 4 to 16 bits.
+
+		unsigned long get_frequency() const;
+
+		/**
+		 * Returns the fastest profile not faster than hz.
+		 *
+		 * @param mode SPI mode (0 to 3) giving CPOL and CPHA.
+		 * @param bits Frame size.
+		 */
+		static profile for_frequency(unsigned long hz, unsigned int mode = 0, unsigned int bits = 8);
+
+		bool
+		operator==(const profile &other) const
+		{
+			return prescaler == other.prescaler && rate == other.rate &&
+				cpol == other.cpol && cpha == other.cpha &&
+				bits == other.bits;
+		}
+
+		bool
+		operator!=(const profile &other) const
+		{
+			return !(*this == other);
+		}
+	};
+
+public:
+	enum { PRIORITY_DEFAULT = 0 };
+
+	/**
+	 * Scoped bus ownership.
+	 */
+	class
+	lock
+		: private boost::noncopyable
+	{
+	public:
+		/**
+		 * @param timeout_us How long to wait for the bus, or -1 to
+		 * wait forever. tsxx::exceptions::timeout is thrown when it
+		 * expires.
+		 */
+		lock(spi &_bus, int priority = PRIORITY_DEFAULT, long timeout_us = -1)
+			: bus(_bus)
+		{
+			if (!bus.acquire(priority, timeout_us))
+				throw tsxx::exceptions::timeout();
+		}
+
+		~lock()
+		{
+			bus.release();
+		}
+
+	private:
+		spi &bus;
+
+	};
+
 public:
 	spi(tsxx::system::memory &memory);
+	~spi();
 
 public:
 	void init();
+	void configure(const profile &p);
+
+	bool acquire(int priority = PRIORITY_DEFAULT, long timeout_us = -1);
+	void release();
+
+	/**
+	 * @param min_hz Slowest rate worth trying; calibration fails below.
+	 */
+	profile calibrate(unsigned long max_hz, unsigned int mode = 0, unsigned int rounds = 16,
+			unsigned long min_hz = 0);
+
+	void use_spidev(tsxx::system::file_descriptor_ptr fd);
+
+	inline bool
+	uses_spidev() const
+	{
+		return spidev.get() != NULL;
+	}
+
+public:
+	/**
+	 * Transfer segment. A NULL tx sends zeroes and a NULL rx discards
+	 * the received data, making read-only and write-only segments.
+	 */
+	struct segment
+	{
+		const void *tx;
+		void *rx;
+		std::size_t len;
+	};
+
+	/**
+	 * Transfer segment for frames wider than 8 bits, one frame per
+	 * element.
+	 */
+	struct segment16
+	{
+		const uint16_t *tx;
+		uint16_t *rx;
+		std::size_t len;
+	};
+
+	void transfer(tsxx::interfaces::binport &cs, const segment *segs, std::size_t nsegs);
+	void transfer(tsxx::interfaces::binport &cs, const segment16 *segs, std::size_t nsegs);
+
+private:
+	/// Position of a transfer in its segments.
+	struct progress
+	{
+		std::size_t txseg, txoff, rxseg, rxoff, inflight;
+	};
 
 public:
+	/**
+	 * Non-blocking transfer(), for the tasks scheduler. The bus is
+	 * taken without waiting on the first poll that finds it free and
+	 * released on the poll which finishes the transfer.
+	 *
+	 * A started transfer owns the bus and the chip select, so it can't
+	 * be copied: construct it where it will be polled.
+	 */
+	class
+	async_transfer
+		: public tsxx::tasks::task, private boost::noncopyable
+	{
+	public:
+		/**
+		 * @param prof Profile to apply once the bus is taken, or NULL.
+		 */
+		async_transfer(spi &_bus, tsxx::interfaces::binport &_cs, const segment *_segs, std::size_t _nsegs,
+				const profile *_prof = NULL, int _priority = PRIORITY_DEFAULT)
+			: bus(_bus), cs(_cs), segs(_segs), nsegs(_nsegs), prof(_prof), priority(_priority),
+			state(IDLE)
+		{
+		}
+
+		/**
+		 * Transfer to a chip, with the chip's profile and priority.
+		 */
+		async_transfer(spi_chip &chip, const segment *_segs, std::size_t _nsegs);
+
+		~async_transfer();
+
+		bool poll();
+
+	private:
+		spi &bus;
+		tsxx::interfaces::binport &cs;
+		const segment *segs;
+		std::size_t nsegs;
+		const profile *prof;
+		int priority;
+
+		enum { IDLE, RUNNING, DRAINING, DONE } state;
+		progress pos;
+
+	};
+
 	void write_read(tsxx::interfaces::binport &cs, const void *wrp, std::size_t wrsiz, void *rdp, std::size_t rdsiz);
+	void write_read(tsxx::interfaces::binport &cs, const uint16_t *wrp, uint16_t *rdp, std::size_t n);
 
 	inline void
 	write_read(tsxx::interfaces::binport &cs, void *rdwrp, std::size_t rdwrsiz)
@@ -320,10 +977,97 @@ public:
 		write_read(cs, &wr_data[0], wr_data.size(), &read_data[0], read_data.size());
 	}
 
+	inline void
+	write_read(tsxx::interfaces::binport &cs, std::vector<uint16_t> &rw_data)
+	{
+		write_read(cs, &rw_data[0], &rw_data[0], rw_data.size());
+	}
+
+	inline void
+	write_read(tsxx::interfaces::binport &cs, const std::vector<uint16_t> &wr_data, std::vector<uint16_t> &read_data)
+	{
+		if (read_data.size() != wr_data.size())
+			read_data.resize(wr_data.size());
+		write_read(cs, &wr_data[0], &read_data[0], wr_data.size());
+	}
+
+	inline void
+	write_read(tsxx::interfaces::binport &cs, tsxx::buffers::span<uint8_t> rw_data)
+	{
+		write_read(cs, rw_data.data(), rw_data.size(), rw_data.data(), rw_data.size());
+	}
+
+	inline void
+	write_read(tsxx::interfaces::binport &cs, tsxx::buffers::span<const uint8_t> wr_data, tsxx::buffers::span<uint8_t> read_data)
+	{
+		write_read(cs, wr_data.data(), wr_data.size(), read_data.data(), read_data.size());
+	}
+
+	inline void
+	write_read(tsxx::interfaces::binport &cs, tsxx::buffers::span<uint16_t> rw_data)
+	{
+		write_read(cs, rw_data.data(), rw_data.data(), rw_data.size());
+	}
+
+	inline void
+	write_read(tsxx::interfaces::binport &cs, tsxx::buffers::span<const uint16_t> wr_data, tsxx::buffers::span<uint16_t> read_data)
+	{
+		if (wr_data.size() > read_data.size())
+			throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+		write_read(cs, wr_data.data(), read_data.data(), wr_data.size());
+	}
+
+private:
+	template <class Word, class Segment>
+	void run(tsxx::interfaces::binport &cs, const Segment *segs, std::size_t nsegs);
+
+	void begin(tsxx::interfaces::binport &cs, progress &pos);
+	template <class Word, class Segment>
+	bool pump(const Segment *segs, std::size_t nsegs, progress &pos);
+	void end(tsxx::interfaces::binport &cs);
+
+	template <class Word, class Segment>
+	void spidev_run(tsxx::interfaces::binport &cs, const Segment *segs, std::size_t nsegs);
+	void spidev_transfer(tsxx::interfaces::binport &cs, const segment *segs, std::size_t nsegs);
+	void spidev_transfer(tsxx::interfaces::binport &cs, const segment16 *segs, std::size_t nsegs);
+
 private:
+	/// Kernel spidev device, when it is used instead of the registers.
+	tsxx::system::file_descriptor_ptr spidev;
+
 	/// SPI registers.
-	tsxx::ports::port16 ctrl, status, data;
-	tsxx::ports::bport16 tx_bit, busy_bit, inp_bit;
+	tsxx::ports::port16 cr0, ctrl, status, data, cpsr;
+	tsxx::ports::bport16 tx_bit, loopback_bit, busy_bit, inp_bit;
+
+	/// Profile currently programmed in the controller, if any.
+	bool configured;
+	profile current;
+
+	/// Whether a transfer is in progress.
+	bool transferring;
+
+	/// Bus arbitration.
+	struct waiter
+	{
+		int priority;
+		unsigned int bypassed;
+		struct sched_param param;
+		int policy;
+		waiter *next;
+	};
+
+	waiter *next_waiter();
+	void boost(const waiter &w);
+	void reboost();
+
+	pthread_mutex_t arb_mutex;
+	pthread_cond_t arb_cond;
+	waiter *waiters;
+	bool owned, boosted;
+	pthread_t owner;
+	unsigned int owner_depth;
+	int owner_policy;
+	struct sched_param owner_param;
 
 };
 
@@ -332,13 +1076,92 @@ spi_chip
 {
 public:
 	spi_chip(spi &_port, tsxx::interfaces::binport &_cs)
-		: port(&_port), cs(_cs)
+		: port(&_port), cs(_cs), has_profile(false),
+		priority(spi::PRIORITY_DEFAULT), timeout_us(-1)
+	{
+	}
+
+	/**
+	 * @param _prof Profile programmed into the controller whenever this
+	 * chip is accessed after a chip with a different profile.
+	 */
+	spi_chip(spi &_port, tsxx::interfaces::binport &_cs, const spi::profile &_prof)
+		: port(&_port), cs(_cs), has_profile(true), prof(_prof),
+		priority(spi::PRIORITY_DEFAULT), timeout_us(-1)
+	{
+	}
+
+	/**
+	 * Sets the bus priority of this chip's transactions and how long
+	 * they may wait for the bus (-1 for ever).
+	 */
+	inline void
+	set_priority(int _priority, long _timeout_us = -1)
+	{
+		priority = _priority;
+		timeout_us = _timeout_us;
+	}
+
+	inline void
+	set_profile(const spi::profile &_prof)
+	{
+		prof = _prof;
+		has_profile = true;
+	}
+
+	inline const spi::profile &
+	get_profile() const
+	{
+		return prof;
+	}
+
+	spi::profile calibrate(unsigned long max_hz, const std::vector<uint8_t> &command,
+			const std::vector<uint8_t> &expected, const std::vector<uint8_t> &mask,
+			unsigned int rounds = 16, unsigned long min_hz = 0);
+
+	inline void
+	transfer(const spi::segment *segs, std::size_t nsegs)
+	{
+		spi::lock l(*port, priority, timeout_us);
+		select();
+		port->transfer(cs, segs, nsegs);
+	}
+
+	inline void
+	transfer(const spi::segment16 *segs, std::size_t nsegs)
+	{
+		spi::lock l(*port, priority, timeout_us);
+		select();
+		port->transfer(cs, segs, nsegs);
+	}
+
+	inline void
+	write_read(const uint16_t *wrp, uint16_t *rdp, std::size_t n)
+	{
+		spi::lock l(*port, priority, timeout_us);
+		select();
+		port->write_read(cs, wrp, rdp, n);
+	}
+
+	inline void
+	write_read(std::vector<uint16_t> &rw_data)
 	{
+		write_read(rw_data, rw_data);
+	}
+
+	inline void
+	write_read(const std::vector<uint16_t> &wr_data, std::vector<uint16_t> &rd_data)
+	{
+		spi::lock l(*port, priority, timeout_us);
+		select();
+		port->write_read(cs, wr_data, rd_data);
 	}
 
 	inline void
 	write_read(void *p, std::size_t siz)
 	{
+		spi::lock l(*port, priority, timeout_us);
+		select();
 		port->write_read(cs, p, siz);
 	}
 
@@ -351,15 +1174,68 @@ public:
 	inline void
 	write_read(const std::vector<uint8_t> &wr_data, std::vector<uint8_t> &rd_data)
 	{
+		spi::lock l(*port, priority, timeout_us);
+		select();
+		port->write_read(cs, wr_data, rd_data);
+	}
+
+	inline void
+	write_read(tsxx::buffers::span<uint8_t> rw_data)
+	{
+		spi::lock l(*port, priority, timeout_us);
+		select();
+		port->write_read(cs, rw_data);
+	}
+
+	inline void
+	write_read(tsxx::buffers::span<const uint8_t> wr_data, tsxx::buffers::span<uint8_t> rd_data)
+	{
+		spi::lock l(*port, priority, timeout_us);
+		select();
+		port->write_read(cs, wr_data, rd_data);
+	}
+
+	inline void
+	write_read(tsxx::buffers::span<uint16_t> rw_data)
+	{
+		spi::lock l(*port, priority, timeout_us);
+		select();
+		port->write_read(cs, rw_data);
+	}
+
+	inline void
+	write_read(tsxx::buffers::span<const uint16_t> wr_data, tsxx::buffers::span<uint16_t> rd_data)
+	{
+		spi::lock l(*port, priority, timeout_us);
+		select();
 		port->write_read(cs, wr_data, rd_data);
 	}
 
 private:
+	inline void
+	select()
+	{
+		if (has_profile)
+			port->configure(prof);
+	}
+
+private:
+	friend class spi::async_transfer;
+
 	spi *port;
 	tsxx::interfaces::binport &cs;
 
+	bool has_profile;
+	spi::profile prof;
+
+	int priority;
+	long timeout_us;
+
 };
 
+std::ostream &operator<<(std::ostream &os, const spi::profile &p);
+std::istream &operator>>(std::istream &is, spi::profile &p);
+
 }
 }
 }
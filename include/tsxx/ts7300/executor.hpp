@@ -0,0 +1,303 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#if !defined(_TSXX_TS7300_EXECUTOR_HPP_)
+#define _TSXX_TS7300_EXECUTOR_HPP_
+
+#include <pthread.h>
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <tsxx/buffers.hpp>
+#include <tsxx/ts7300.hpp>
+
+namespace tsxx
+{
+namespace ts7300
+{
+
+/**
+ * I/O thread owning the board.
+ *
+ * Application threads don't touch the hardware: each one submits
+ * operations through its own channel and later collects them back, in
+ * submission order, once they have run. Channels are pairs of lock-free
+ * rings, so neither side ever blocks on the other. The I/O thread runs
+ * everything pending on all channels in one pass and only sleeps when
+ * there is nothing to do.
+ *
+ * Operations are owned by the submitter and must stay alive until they
+ * are collected.
+ */
+class
+executor
+	: private boost::noncopyable
+{
+public:
+	class
+	operation
+	{
+	public:
+		operation()
+			: failed(false)
+		{
+		}
+
+		virtual
+		~operation()
+		{
+		}
+
+		/**
+		 * Runs on the I/O thread. Exceptions are caught and reported
+		 * through has_failed() and get_error().
+		 */
+		virtual void run(board &b) = 0;
+
+		inline bool
+		has_failed() const
+		{
+			return failed;
+		}
+
+		inline const std::string &
+		get_error() const
+		{
+			return error;
+		}
+
+	private:
+		friend class executor;
+
+		bool failed;
+		std::string error;
+
+	};
+
+	/**
+	 * Submission and completion rings of one application thread.
+	 */
+	class
+	channel
+		: private boost::noncopyable
+	{
+	public:
+		/**
+		 * @param depth Maximum number of operations submitted and not
+		 * collected yet.
+		 */
+		channel(std::size_t depth)
+			: submissions(depth), completions(depth), outstanding(0), limit(depth), next(NULL)
+		{
+		}
+
+		/**
+		 * Queues an operation. Returns false when depth operations
+		 * are already outstanding.
+		 */
+		bool
+		submit(operation *op)
+		{
+			if (outstanding >= limit || !submissions.push(op))
+				return false;
+			outstanding++;
+			return true;
+		}
+
+		/**
+		 * Returns the next finished operation, or NULL if none.
+		 */
+		operation *
+		collect()
+		{
+			operation *op;
+			if (!completions.pop(op))
+				return NULL;
+			outstanding--;
+			return op;
+		}
+
+		inline std::size_t
+		get_outstanding() const
+		{
+			return outstanding;
+		}
+
+	private:
+		friend class executor;
+
+		tsxx::buffers::ring<operation *> submissions, completions;
+
+		// Only used by the application thread.
+		std::size_t outstanding;
+		const std::size_t limit;
+
+		channel *next;
+
+	};
+
+public:
+	/**
+	 * @param idle_us How long the I/O thread sleeps when it finds no
+	 * work.
+	 */
+	executor(board &b, unsigned int idle_us = 100);
+	~executor();
+
+	void attach(channel &c);
+
+	void start();
+	void stop();
+
+private:
+	static void *thread_main(void *arg);
+	bool run_pending();
+
+private:
+	board &brd;
+	const unsigned int idle_us;
+
+	channel *channels;
+
+	pthread_t thread;
+	bool started;
+	volatile bool stopping;
+
+};
+
+namespace operations
+{
+
+template <class WordPort> class
+port_write
+	: public executor::operation
+{
+public:
+	port_write(WordPort &_port, typename WordPort::word_type _word)
+		: port(_port), word(_word)
+	{
+	}
+
+	void
+	run(board &)
+	{
+		port.write(word);
+	}
+
+private:
+	WordPort &port;
+	typename WordPort::word_type word;
+
+};
+
+template <class WordPort> class
+port_read
+	: public executor::operation
+{
+public:
+	port_read(WordPort &_port)
+		: port(_port), word(0)
+	{
+	}
+
+	void
+	run(board &)
+	{
+		word = port.read();
+	}
+
+	inline typename WordPort::word_type
+	get() const
+	{
+		return word;
+	}
+
+private:
+	WordPort &port;
+	typename WordPort::word_type word;
+
+};
+
+class
+spi_transfer
+	: public executor::operation
+{
+public:
+	spi_transfer(devices::spi_chip &_chip, const devices::spi::segment *_segs, std::size_t _nsegs)
+		: chip(_chip), segs(_segs), nsegs(_nsegs)
+	{
+	}
+
+	void
+	run(board &)
+	{
+		chip.transfer(segs, nsegs);
+	}
+
+private:
+	devices::spi_chip &chip;
+	const devices::spi::segment *segs;
+	std::size_t nsegs;
+
+};
+
+class
+lcd_print
+	: public executor::operation
+{
+public:
+	lcd_print(unsigned int _x, unsigned int _y, const void *_p, std::size_t _len)
+		: x(_x), y(_y), p(_p), len(_len)
+	{
+	}
+
+	void
+	run(board &b)
+	{
+		b.get_lcd().ddram(x, y);
+		b.get_lcd().wait();
+		b.get_lcd().print(p, len);
+	}
+
+private:
+	unsigned int x, y;
+	const void *p;
+	std::size_t len;
+
+};
+
+}
+
+}
+}
+
+#endif // !defined(_TSXX_TS7300_EXECUTOR_HPP_)
@@ -0,0 +1,144 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#if !defined(_TSXX_TS7300_FLASH_HPP_)
+#define _TSXX_TS7300_FLASH_HPP_
+
+#include <boost/noncopyable.hpp>
+
+#include <tsxx/tasks.hpp>
+#include <tsxx/ts7300.hpp>
+
+namespace tsxx
+{
+namespace ts7300
+{
+
+/**
+ * SPI NOR flash (25 series command set) on a spi_chip.
+ *
+ * Reads are streamed into the caller's buffer in a single fast read
+ * transaction of any length. Programming goes page by page through
+ * program_task, which can run under a tasks::scheduler so that the next
+ * data is staged while the flash is busy with the current page.
+ *
+ * Before every write enable the boot EEPROM chip select is checked to be
+ * de-asserted (see board::init()); if it isn't, it is de-asserted and
+ * tsxx::exceptions::invalid_state is thrown.
+ */
+class
+spi_flash
+	: private boost::noncopyable
+{
+private:
+	enum {
+		CMD_WRSR =	0x01,
+		CMD_PP =	0x02,
+		CMD_READ =	0x03,
+		CMD_WRDI =	0x04,
+		CMD_RDSR =	0x05,
+		CMD_WREN =	0x06,
+		CMD_FAST_READ =	0x0b,
+		CMD_SE =	0x20,
+		CMD_RDID =	0x9f,
+
+		SR_WIP =	0x01,
+		SR_WEL =	0x02,
+	};
+
+public:
+	enum {
+		PAGE_SIZE = 256,
+		SECTOR_SIZE = 4096,
+	};
+
+public:
+	spi_flash(devices::spi_chip &chip, tsxx::system::memory &memory);
+
+	uint32_t read_id();
+	void read(uint32_t addr, void *buf, std::size_t len);
+	void program(uint32_t addr, const void *buf, std::size_t len);
+	void erase_sector(uint32_t addr);
+
+	bool busy();
+	void wait();
+
+public:
+	/**
+	 * Programs a buffer one page at a time. Each poll either checks the
+	 * status of the page in progress once or starts the next page. The
+	 * buffer must stay valid until the task finishes.
+	 */
+	class
+	program_task
+		: public tsxx::tasks::task
+	{
+	public:
+		program_task(spi_flash &_flash, uint32_t _addr, const void *_buf, std::size_t _len)
+			: flash(_flash), addr(_addr), buf(static_cast<const uint8_t *>(_buf)), len(_len),
+			in_progress(false)
+		{
+		}
+
+		bool poll();
+
+	private:
+		spi_flash &flash;
+		uint32_t addr;
+		const uint8_t *buf;
+		std::size_t len;
+		bool in_progress;
+
+	};
+
+private:
+	void write_enable();
+	void write_page(uint32_t addr, const void *buf, std::size_t len);
+
+	static void
+	set_address(uint8_t *p, uint32_t addr)
+	{
+		p[0] = addr >> 16;
+		p[1] = addr >> 8;
+		p[2] = addr;
+	}
+
+private:
+	devices::spi_chip &chip;
+
+	tsxx::ports::port8 eeprom_cs_port;
+	tsxx::ports::bport8 eeprom_cs_bit;
+
+};
+
+}
+}
+
+#endif // !defined(_TSXX_TS7300_FLASH_HPP_)
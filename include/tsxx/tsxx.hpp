@@ -31,13 +31,21 @@
 #if !defined(_TSXX_TSXX_HPP_)
 #define _TSXX_TSXX_HPP_
 
+#include <tsxx/buffers.hpp>
 #include <tsxx/exceptions.hpp>
+#include <tsxx/filters.hpp>
 #include <tsxx/interfaces.hpp>
 #include <tsxx/ports.hpp>
+#include <tsxx/protocols.hpp>
 #include <tsxx/registers.hpp>
+#include <tsxx/signals.hpp>
 #include <tsxx/system.hpp>
+#include <tsxx/tasks.hpp>
 #include <tsxx/utils.hpp>
 
 #include <tsxx/ts7300.hpp>
+#include <tsxx/ts7300/acquisition.hpp>
+#include <tsxx/ts7300/executor.hpp>
+#include <tsxx/ts7300/flash.hpp>
 
 #endif // !defined(_TSXX_TSXX_HPP_)
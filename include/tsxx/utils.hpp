@@ -42,23 +42,35 @@ class
 hw
 {
 public:
-	static float
-	uptime(tsxx::system::memory &mem)
+	/**
+	 * Reads the board's free running hardware counter.
+	 *
+	 * @param persec Set to the counter's ticks per second.
+	 */
+	static uint32_t
+	counter(tsxx::system::memory &mem, uint32_t &persec)
 	{
 		enum model::BoardModel model = model::identify_board(mem);
-		uint32_t persec, n;
 
 		if (model == model::TS7300) {
 			tsxx::ports::port32 reg(mem.get_region(0x12000004));
 
-			n = reg.read();
 			persec = 14745600;
+			return reg.read();
 		} else {
 			tsxx::ports::port32 reg(mem.get_region(0x80810060));
 
-			n = reg.read();
 			persec = 983040;
+			return reg.read();
 		}
+	}
+
+	static float
+	uptime(tsxx::system::memory &mem)
+	{
+		uint32_t persec, n;
+
+		n = counter(mem, persec);
 
 		return static_cast<float>(n) / persec;
 	}
@@ -70,23 +82,97 @@ cpu
 private:
 	cpu();
 
-public:
-	// TODO Calibrate this function.
 	/**
-	 * @warning This function hasn't been calibrated yet.
+	 * Busy loop speed. Until calibrate() is called it is the former
+	 * fixed guess of 5 iterations per nanosecond.
 	 */
+	struct speed
+	{
+		unsigned int loops_per_us;
+		/// Iterations per nanosecond, in 16.16 fixed point.
+		uint32_t loops_per_ns_q16;
+		/// Longest wait whose iterations fit in 32 bits.
+		uint32_t max_ns;
+	};
+
+	static inline speed &
+	get_speed()
+	{
+		static speed s = { 5000, 5 << 16, 0xffffffffu / (5 << 16) };
+		return s;
+	}
+
 	static inline void
-	nssleep(unsigned int ns)
+	spin(unsigned int loops)
 	{
-		volatile unsigned int loop = ns * 5;
+		if (loops == 0)
+			return;
+
 		asm volatile (
 			"1:\n"
-			"subs %1, %1, #1;\n"
+			"subs %0, %0, #1;\n"
 			"bne 1b;\n"
-			: "=r" ((loop)) : "r" ((loop))
+			: "+r" (loops) : : "cc"
 		);
 	}
 
+public:
+	/**
+	 * Times the busy loop of nssleep() against the board's hardware
+	 * counter. Should be called once at startup, before any timing
+	 * sensitive bit-banging.
+	 */
+	static void
+	calibrate(tsxx::system::memory &mem)
+	{
+		enum { LOOPS = 1000000 };
+		uint32_t persec;
+
+		const uint32_t start = hw::counter(mem, persec);
+		spin(LOOPS);
+		const uint32_t ticks = hw::counter(mem, persec) - start;
+
+		if (ticks == 0)
+			throw tsxx::exceptions::unknown_error(__FILE__, __LINE__);
+
+		uint64_t n = static_cast<uint64_t>(LOOPS) * persec / (static_cast<uint64_t>(ticks) * 1000000);
+		speed &s = get_speed();
+		s.loops_per_us = n > 0 ? static_cast<unsigned int>(n) : 1;
+
+		// Divisions are done once here, so nssleep() only multiplies.
+		uint64_t q16 = (static_cast<uint64_t>(s.loops_per_us) << 16) / 1000;
+		if (q16 == 0)
+			q16 = 1;
+		else if (q16 > 0xffffffffu)
+			q16 = 0xffffffffu;
+		s.loops_per_ns_q16 = static_cast<uint32_t>(q16);
+		s.max_ns = 0xffffffffu / s.loops_per_ns_q16;
+	}
+
+	static inline unsigned int
+	get_loops_per_us()
+	{
+		return get_speed().loops_per_us;
+	}
+
+	/**
+	 * Busy waits for about ns nanoseconds.
+	 *
+	 * @warning Only accurate after calibrate().
+	 */
+	static inline void
+	nssleep(unsigned int ns)
+	{
+		const speed &s = get_speed();
+
+		// 32 bits multiplies only: the ARM9 has no 64 bits divide.
+		while (ns > s.max_ns) {
+			spin((s.max_ns * s.loops_per_ns_q16) >> 16);
+			ns -= s.max_ns;
+		}
+		spin((ns * s.loops_per_ns_q16) >> 16);
+	}
+
 };
 
 }
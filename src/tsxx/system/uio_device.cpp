@@ -0,0 +1,115 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <tsxx/system.hpp>
+
+using tsxx::system::uio_device;
+
+uio_device::uio_device()
+	: read_size(sizeof(uint32_t)), rearmable(false)
+{
+}
+
+void
+uio_device::attach(file_descriptor_ptr _fd)
+{
+	if (_fd.get() == NULL || !_fd->is_valid())
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	fd = _fd;
+	read_size = sizeof(uint32_t);
+	rearmable = true;
+}
+
+/**
+ * Waits for an interrupt and consumes its count.
+ *
+ * @param timeout_ms -1 to wait for ever.
+ * @return false if nothing arrived within timeout_ms.
+ */
+bool
+uio_device::wait(int timeout_ms)
+{
+	if (fd.get() == NULL)
+		throw tsxx::exceptions::invalid_state();
+
+	struct pollfd pfd;
+	pfd.fd = fd->get_value();
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	int r = ::poll(&pfd, 1, timeout_ms);
+	if (r == -1) {
+		if (errno == EINTR)
+			return false;
+		throw tsxx::exceptions::stdio_error(errno);
+	}
+	if (r == 0)
+		return false;
+
+	// UIO delivers a 4 bytes count, an eventfd only reads 8 bytes.
+	uint64_t count;
+	ssize_t n = ::read(pfd.fd, &count, read_size);
+	if (n == -1 && errno == EINVAL && read_size == sizeof(uint32_t)) {
+		read_size = sizeof(uint64_t);
+		n = ::read(pfd.fd, &count, read_size);
+	}
+	if (n == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return false;
+		throw tsxx::exceptions::stdio_error(errno);
+	}
+
+	return true;
+}
+
+/**
+ * UIO masks the interrupt after each delivery until 1 is written back.
+ * An eventfd rejects 4 bytes writes, which is taken as having nothing to
+ * re-arm.
+ */
+void
+uio_device::rearm()
+{
+	if (!rearmable)
+		return;
+
+	uint32_t one = 1;
+	if (::write(fd->get_value(), &one, sizeof(one)) == -1) {
+		if (errno != EINVAL)
+			throw tsxx::exceptions::stdio_error(errno);
+		rearmable = false;
+	}
+}
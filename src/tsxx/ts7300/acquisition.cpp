@@ -0,0 +1,168 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#include <sched.h>
+
+#include <tsxx/ts7300/acquisition.hpp>
+
+using tsxx::ts7300::acquisition;
+using tsxx::ts7300::devices::timer;
+
+acquisition::acquisition(devices::spi_chip &_chip, devices::timer &_tmr, const std::vector<uint8_t> &_frame,
+		unsigned long rate_hz, std::size_t _block_samples, std::size_t nblocks)
+	: chip(_chip), tmr(_tmr), frame(_frame),
+	period(rate_hz > 0 ? timer::TICKS_PER_SECOND / rate_hz : 0),
+	block_samples(_block_samples),
+	blocks(nblocks), committed(0),
+	started(false), stopping(false),
+	samples(0), overruns(0), late(0),
+	failed(false)
+{
+	if (frame.empty() || period == 0 || block_samples == 0)
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	// One extra block to sample into while the ring is full.
+	const std::size_t n = blocks.get_capacity() + 1;
+	timestamps.resize(n * block_samples);
+	data.resize(n * block_samples * frame.size());
+}
+
+acquisition::~acquisition()
+{
+	stop();
+}
+
+void
+acquisition::start(int rt_priority)
+{
+	if (started)
+		throw tsxx::exceptions::invalid_state();
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (rt_priority > 0) {
+		struct sched_param param;
+		param.sched_priority = rt_priority;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+
+	stopping = false;
+	failed = false;
+	error.clear();
+	int result = pthread_create(&thread, &attr, thread_main, this);
+	pthread_attr_destroy(&attr);
+	if (result != 0)
+		throw tsxx::exceptions::stdio_error(result);
+	started = true;
+}
+
+void
+acquisition::stop()
+{
+	if (!started)
+		return;
+
+	stopping = true;
+	pthread_join(thread, NULL);
+	started = false;
+}
+
+void *
+acquisition::thread_main(void *arg)
+{
+	acquisition *self = static_cast<acquisition *>(arg);
+
+	// Nothing may escape the thread, or the process terminates.
+	try {
+		self->loop();
+	} catch (const std::exception &e) {
+		self->error = e.what();
+		__sync_synchronize();
+		self->failed = true;
+	} catch (...) {
+		self->error = "unknown error";
+		__sync_synchronize();
+		self->failed = true;
+	}
+
+	return NULL;
+}
+
+void
+acquisition::loop()
+{
+	const std::size_t fsiz = frame.size();
+	const std::size_t spare = blocks.get_capacity();
+	tsxx::buffers::span<const uint8_t> cmd(&frame[0], fsiz);
+	unsigned long sequence = 0;
+	uint32_t next = tmr.read();
+
+	while (!stopping) {
+		block *b = blocks.back();
+		// The slot the ring hands out next is always tail % capacity,
+		// also after a restart with blocks still waiting in the ring.
+		const std::size_t slot = b != NULL ? committed & (blocks.get_capacity() - 1) : spare;
+		uint32_t *ts = &timestamps[slot * block_samples];
+		uint8_t *dat = &data[slot * block_samples * fsiz];
+
+		for (std::size_t i = 0; i < block_samples; i++) {
+			uint32_t now;
+
+			while (static_cast<int32_t>((now = tmr.read()) - next) < 0)
+				;
+
+			if (now - next >= period) {
+				// Skip the slots we missed instead of bursting.
+				late = late + (now - next) / period;
+				next = now;
+			}
+			next += period;
+
+			ts[i] = now;
+			chip.write_read(cmd, tsxx::buffers::span<uint8_t>(dat + i * fsiz, fsiz));
+		}
+
+		samples = samples + block_samples;
+
+		if (b == NULL) {
+			overruns = overruns + 1;
+		} else {
+			b->sequence = sequence;
+			b->count = block_samples;
+			b->timestamps = ts;
+			b->data = dat;
+			blocks.commit();
+			committed++;
+		}
+		sequence++;
+	}
+}
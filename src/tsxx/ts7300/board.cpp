@@ -35,9 +35,10 @@ using tsxx::ts7300::devices::xdio;
 using tsxx::ts7300::devices::dio1;
 using tsxx::ts7300::devices::lcd;
 using tsxx::ts7300::devices::spi;
+using tsxx::ts7300::devices::timer;
 
 board::board(tsxx::system::memory &mem)
-	: memory(mem), xdio1(memory, 0), xdio2(memory, 1), dio1(memory), lcd(memory), spi(memory)
+	: memory(mem), xdio1(memory, 0), xdio2(memory, 1), dio1(memory), lcd(memory), spi(memory), timer(memory)
 {
 }
 
@@ -66,8 +67,8 @@ board::init()
 	// PS: Believe me, I've done this. I've seen the RLOD (Red Led
 	// Of Death). =(
 	{
-		tsxx::ports::port8 eeprom_cs_port(memory.get_region(0x23000000));
-		tsxx::ports::bport8 eeprom_cs_bit(eeprom_cs_port, 0);
+		tsxx::ports::port8 eeprom_cs_port(memory.get_region(EEPROM_CS_ADDR));
+		tsxx::ports::bport8 eeprom_cs_bit(eeprom_cs_port, EEPROM_CS_BIT);
 		eeprom_cs_bit.unset();
 	}
 
@@ -76,7 +77,8 @@ board::init()
 
 	// If we initialize the lcd object it will send commands to LCD device.
 	// As we don't know the TS-7300 board is connected to an LCD device, we
-	// don't do that.
+	// don't do that. Users should call get_lcd().init(), or
+	// get_lcd().attach() to keep a display which is already configured.
 	//lcd.init();
 
 	spi.init();
@@ -111,3 +113,9 @@ board::get_spi()
 {
 	return spi;
 }
+
+timer &
+board::get_timer()
+{
+	return timer;
+}
@@ -0,0 +1,311 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <tsxx/ts7300/devices.hpp>
+
+using tsxx::ts7300::devices::gpio_irq;
+
+namespace
+{
+
+/// Interrupt registers, relative to the port's first one.
+enum {
+	INT_TYPE1 = 0x00,
+	INT_TYPE2 = 0x04,
+	INT_EOI = 0x08,
+	INT_EN = 0x0c,
+	INT_STATUS = 0x10,
+	INT_DB = 0x18,
+};
+
+uint64_t
+now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+}
+
+gpio_irq::gpio_irq(tsxx::system::memory &memory, port_id port)
+	: data(memory.get_region(data_addr(port))),
+	type1(memory.get_region(irq_addr(port, INT_TYPE1))),
+	type2(memory.get_region(irq_addr(port, INT_TYPE2))),
+	eoi(memory.get_region(irq_addr(port, INT_EOI))),
+	enable_reg(memory.get_region(irq_addr(port, INT_EN))),
+	status(memory.get_region(irq_addr(port, INT_STATUS))),
+	debounce(memory.get_region(irq_addr(port, INT_DB))),
+	source(SOURCE_UIO),
+	sysfs_pin(0), sysfs_level(false),
+	enabled(0), rising(0), falling(0), pending(0), holdoff_ns(0)
+{
+	for (unsigned int i = 0; i < 8; i++)
+		last_edge[i] = 0;
+}
+
+gpio_irq::~gpio_irq()
+{
+	if (enabled && source != SOURCE_SYSFS)
+		enable_reg.write(enable_reg.read() & ~enabled);
+}
+
+unsigned long
+gpio_irq::data_addr(port_id port)
+{
+	switch (port) {
+	case PORT_A:
+		return BASE_ADDR + 0x00;
+	case PORT_B:
+		return BASE_ADDR + 0x04;
+	case PORT_F:
+		return BASE_ADDR + 0x30;
+	}
+
+	throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+}
+
+unsigned long
+gpio_irq::irq_addr(port_id port, unsigned int offset)
+{
+	switch (port) {
+	case PORT_A:
+		return BASE_ADDR + 0x90 + offset;
+	case PORT_B:
+		return BASE_ADDR + 0xac + offset;
+	case PORT_F:
+		return BASE_ADDR + 0x4c + offset;
+	}
+
+	throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+}
+
+/**
+ * @param _fd /dev/uioN, a sysfs-gpio value file whose edge is "both", or
+ * an eventfd standing in for the UIO device.
+ */
+void
+gpio_irq::attach(tsxx::system::file_descriptor_ptr _fd, source_type type, unsigned int bit)
+{
+	if (_fd.get() == NULL || !_fd->is_valid() || bit > 7)
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	// The registers may have been programmed for the other source.
+	if (enabled)
+		throw tsxx::exceptions::invalid_state();
+
+	fd = _fd;
+	source = type;
+
+	if (source == SOURCE_SYSFS) {
+		sysfs_pin = 1 << bit;
+		// Also clears the notification pending since the file was opened.
+		sysfs_level = read_level();
+	} else {
+		uio.attach(fd);
+		uio.rearm();
+	}
+}
+
+/**
+ * Reads the level of a SOURCE_SYSFS value file.
+ */
+bool
+gpio_irq::read_level()
+{
+	char value[8];
+	ssize_t n;
+
+	if (lseek(fd->get_value(), 0, SEEK_SET) == -1 ||
+			(n = ::read(fd->get_value(), value, sizeof(value))) == -1)
+		throw tsxx::exceptions::stdio_error(errno);
+
+	return n > 0 && value[0] == '1';
+}
+
+void
+gpio_irq::enable(word_type mask, edge e, bool debounced)
+{
+	if (source == SOURCE_SYSFS && (debounced || (mask & ~sysfs_pin) != 0))
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	rising = e != EDGE_FALLING ? (rising | mask) : (rising & ~mask);
+	falling = e != EDGE_RISING ? (falling | mask) : (falling & ~mask);
+
+	// The kernel owns the registers, edges are filtered in handle().
+	if (source == SOURCE_SYSFS) {
+		enabled |= mask;
+		return;
+	}
+
+	// Masked while reprogramming, so no spurious interrupt is raised.
+	enable_reg.write(enable_reg.read() & ~mask);
+
+	type1.write(type1.read() | mask);
+
+	word_type polarity = type2.read() & ~mask;
+	switch (e) {
+	case EDGE_FALLING:
+		break;
+	case EDGE_RISING:
+		polarity |= mask;
+		break;
+	case EDGE_BOTH:
+		// Wait for the opposite of the current level.
+		polarity |= ~data.read() & mask;
+		break;
+	}
+	type2.write(polarity);
+
+	word_type db = debounce.read();
+	debounce.write(debounced ? (db | mask) : (db & ~mask));
+
+	eoi.write(mask);
+	enabled |= mask;
+	enable_reg.write(enable_reg.read() | mask);
+}
+
+void
+gpio_irq::disable(word_type mask)
+{
+	if (source != SOURCE_SYSFS) {
+		enable_reg.write(enable_reg.read() & ~mask);
+		eoi.write(mask);
+	}
+
+	enabled &= ~mask;
+	rising &= ~mask;
+	falling &= ~mask;
+	pending &= ~mask;
+}
+
+/**
+ * Waits for the event fd, then acknowledges and collects the edges.
+ *
+ * @return false if nothing arrived within timeout_ms.
+ */
+bool
+gpio_irq::handle(int timeout_ms)
+{
+	if (fd.get() == NULL)
+		throw tsxx::exceptions::invalid_state();
+
+	word_type edges;
+
+	if (source == SOURCE_SYSFS) {
+		struct pollfd pfd;
+		pfd.fd = fd->get_value();
+		pfd.events = POLLPRI | POLLERR;
+		pfd.revents = 0;
+
+		int r = ::poll(&pfd, 1, timeout_ms);
+		if (r == -1) {
+			if (errno == EINTR)
+				return false;
+			throw tsxx::exceptions::stdio_error(errno);
+		}
+		if (r == 0)
+			return false;
+
+
+		// The kernel has already acknowledged the interrupt: the edge
+		// is told from the level change.
+		const bool level = read_level();
+		edges = level != sysfs_level ? sysfs_pin : 0;
+		sysfs_level = level;
+		edges &= enabled & (level ? rising : falling);
+	} else {
+		if (!uio.wait(timeout_ms))
+			return false;
+
+		edges = status.read() & enabled;
+		eoi.write(edges);
+
+		const word_type flip = edges & rising & falling;
+		if (flip)
+			type2.write((type2.read() & ~flip) | (~data.read() & flip));
+	}
+
+	uint64_t now = now_ns();
+	for (unsigned int i = 0; i < 8; i++) {
+		if (!(edges & (1 << i)))
+			continue;
+		if (holdoff_ns != 0 && now - last_edge[i] < holdoff_ns)
+			continue;
+		last_edge[i] = now;
+		pending |= 1 << i;
+	}
+
+	if (source != SOURCE_SYSFS)
+		uio.rearm();
+
+	return true;
+}
+
+bool
+gpio_irq::wait(word_type &events, int timeout_ms)
+{
+	const uint64_t deadline = timeout_ms > 0 ?
+		now_ns() + static_cast<uint64_t>(timeout_ms) * 1000000 : 0;
+
+	while (pending == 0) {
+		int left = timeout_ms;
+		if (timeout_ms > 0) {
+			uint64_t now = now_ns();
+			if (now >= deadline)
+				return false;
+			left = static_cast<int>((deadline - now + 999999) / 1000000);
+		}
+
+		// Edges dropped by the holdoff don't end the wait.
+		if (!handle(left) && timeout_ms >= 0)
+			return false;
+	}
+
+	events = get_events();
+
+	return true;
+}
+
+bool
+gpio_irq::poll()
+{
+	if (pending == 0)
+		handle(0);
+
+	return pending != 0;
+}
@@ -28,6 +28,8 @@
 // are those of the authors and should not be interpreted as representing
 // official policies, either expressed or implied, of Fernando Silveira.
 
+#include <string.h>
+
 #include <tsxx/ts7300/devices.hpp>
 
 #include <tsxx/utils.hpp>
@@ -47,8 +49,10 @@ lcd::lcd(tsxx::system::memory &memory)
 	data_mask(0x7f), data7_mask(0x01),
 	data_bit_busy(0x80),
 	ctrl(memory.get_region(BASE_ADDR + 0x40), memory.get_region(BASE_ADDR + 0x44)),
-	ctrl_bit_en(0x08), ctrl_bit_rs(0x10), ctrl_bit_wr(0x20)
+	ctrl_bit_en(0x08), ctrl_bit_rs(0x10), ctrl_bit_wr(0x20),
+	marquee_row(0), marquee_width(0), marquee_pos(0), marquee_offset(0)
 {
+	invalidate_glyphs();
 }
 
 void
@@ -102,6 +106,52 @@ lcd::init()
 	command(LCD_CMD_HOME);
 	usleep(1530);
 	wait();
+
+	// CGRAM contents are undefined after power on.
+	invalidate_glyphs();
+}
+
+/**
+ * Attaches to a controller which has already been initialized, e.g. by a
+ * previous run of the program, without the power-on sequence: the display
+ * is neither cleared nor reconfigured.
+ *
+ * The controller must report not busy and must read back two different
+ * DDRAM addresses set by commands, after which the original address
+ * counter is restored. If any check fails false is returned and init()
+ * should be used instead.
+ */
+bool
+lcd::attach()
+{
+	static const uint8_t probes[] = { 0x15, 0x4a };
+	uint8_t address, readback;
+
+	// Set LCD control pins as outputs.
+	ctrl.set_dir(ctrl.get_dir() | ctrl_bit_en | ctrl_bit_rs | ctrl_bit_wr);
+
+	// De-assert EN and RS.
+	ctrl.write(ctrl.read() & ~(ctrl_bit_rs | ctrl_bit_en));
+
+	if (!wait(address))
+		return false;
+
+	// The probe addresses have complementary bits, so stuck or floating
+	// data lines can't pass.
+	bool ok = true;
+	for (unsigned int i = 0; ok && i < sizeof(probes); i++) {
+		command(LCD_CMD_DDRAM | probes[i]);
+		ok = wait(readback) && readback == probes[i];
+	}
+
+	command(LCD_CMD_DDRAM | address);
+	if (!wait(readback) || readback != address)
+		ok = false;
+
+	// Whatever is in CGRAM wasn't loaded by us.
+	invalidate_glyphs();
+
+	return ok;
 }
 
 void
@@ -117,12 +167,16 @@ lcd::print(const void *p, std::size_t len)
 	data.set_dir(data.get_dir() | data_mask);
 	data7.set_dir(data7.get_dir() | data7_mask);
 
+	// Shadow ports A, C and H for the whole burst: the bits outside the
+	// LCD masks are read only once and each character costs stores only.
 	tsxx::ports::port8::word_type c = ctrl.read();
+	const tsxx::ports::port8::word_type d = data.read() & ~data_mask;
+	const tsxx::ports::port8::word_type d7 = data7.read() & ~data7_mask;
 
 	for (const uint8_t *s = static_cast<const uint8_t *>(p); len-- > 0; s++) {
 		// Write data to be sent.
-		data.write((data.read() & ~data_mask) | (*s & data_mask));
-		data7.write((data7.read() & ~data7_mask) | ((*s >> 7) & data7_mask));
+		data.write(d | (*s & data_mask));
+		data7.write(d7 | ((*s >> 7) & data7_mask));
 
 		// Assert WR and RS.
 		c = (c & ~ctrl_bit_wr) | ctrl_bit_rs;
@@ -147,6 +201,13 @@ lcd::print(const void *p, std::size_t len)
 	}
 }
 
+void
+lcd::print(const glyph &g)
+{
+	uint8_t c = load_glyph(g);
+	print(&c, 1);
+}
+
 void
 lcd::command(uint8_t cmd)
 {
@@ -190,9 +251,16 @@ lcd::command(uint8_t cmd)
 
 bool
 lcd::wait()
+{
+	uint8_t address;
+	return wait(address);
+}
+
+bool
+lcd::wait(uint8_t &address)
 {
 	unsigned int tries;
-	tsxx::ports::port8::word_type d, c = ctrl.read();
+	uint8_t d;
 
 	// Set LCD data pins as inputs.
 	data.set_dir(data.get_dir() & ~data_mask);
@@ -200,31 +268,191 @@ lcd::wait()
 
 	tries = 0;
 	do {
-		// De-assert RS and WR.
-		c = (c | ctrl_bit_wr) & ~ctrl_bit_rs;
-		ctrl.write(c);
+		d = read_status();
+	} while ((d & data_bit_busy) != 0 && tries++ < 1024);
 
-		// Sleep 100ns at least.
-		cpu::nssleep(100);
+	address = d & ~data_bit_busy;
 
-		// Assert EN.
-		c |= ctrl_bit_en;
-		ctrl.write(c);
+	return (d & data_bit_busy) == 0;
+}
 
-		// Sleep 300ns at least.
-		cpu::nssleep(300);
+bool
+lcd::async_wait::poll()
+{
+	// Other tasks may have used the data pins in between.
+	dev.data.set_dir(dev.data.get_dir() & ~dev.data_mask);
+	dev.data7.set_dir(dev.data7.get_dir() & ~dev.data7_mask);
 
-		// De-assert EN, read result
+	return (dev.read_status() & dev.data_bit_busy) == 0;
+}
 
-		d = (data.read() & data_mask) | ((data7.read() & data7_mask) << 7);
+/**
+ * Reads the busy flag and the address counter once. The data pins must
+ * already be set as inputs.
+ */
+uint8_t
+lcd::read_status()
+{
+	tsxx::ports::port8::word_type d, c = ctrl.read();
 
-		// De-assert EN.
-		c &= ~ctrl_bit_en;
-		ctrl.write(c);
+	// De-assert RS and WR.
+	c = (c | ctrl_bit_wr) & ~ctrl_bit_rs;
+	ctrl.write(c);
 
-		// Sleep 200ns at least.
-		cpu::nssleep(200);
-	} while ((d & data_bit_busy) != 0 && tries++ < 1024);
+	// Sleep 100ns at least.
+	cpu::nssleep(100);
 
-	return (d & data_bit_busy) == 0;
+	// Assert EN.
+	c |= ctrl_bit_en;
+	ctrl.write(c);
+
+	// Sleep 300ns at least.
+	cpu::nssleep(300);
+
+	// De-assert EN, read result
+
+	d = (data.read() & data_mask) | ((data7.read() & data7_mask) << 7);
+
+	// De-assert EN.
+	c &= ~ctrl_bit_en;
+	ctrl.write(c);
+
+	// Sleep 200ns at least.
+	cpu::nssleep(200);
+
+	return d;
+}
+
+/**
+ * Returns the character code of a custom glyph, uploading it to CGRAM
+ * only when it isn't already loaded. When all 8 slots are in use the
+ * least recently used one is replaced, so any text still showing that
+ * slot changes too: a frame must not use more than 8 distinct glyphs.
+ *
+ * The DDRAM address counter is restored after an upload, so this can be
+ * called in the middle of printing a line.
+ */
+uint8_t
+lcd::load_glyph(const glyph &g)
+{
+	const uint32_t hash = hash_glyph(g);
+	unsigned int i, victim = 0;
+
+	for (i = 0; i < GLYPH_SLOTS; i++) {
+		glyph_slot &slot = glyph_slots[i];
+
+		if (slot.used && slot.hash == hash &&
+				memcmp(slot.data.rows, g.rows, sizeof(g.rows)) == 0) {
+			slot.stamp = ++glyph_clock;
+			return i;
+		}
+
+		if (!glyph_slots[victim].used)
+			continue;
+		if (!slot.used || slot.stamp < glyph_slots[victim].stamp)
+			victim = i;
+	}
+
+	uint8_t address;
+	wait(address);
+
+	cgram(victim * sizeof(g.rows));
+	wait();
+	print(g.rows, sizeof(g.rows));
+	wait();
+
+	command(LCD_CMD_DDRAM | address);
+	wait();
+
+	glyph_slot &slot = glyph_slots[victim];
+	slot.used = true;
+	slot.hash = hash;
+	slot.stamp = ++glyph_clock;
+	slot.data = g;
+
+	return victim;
+}
+
+/**
+ * Forgets which glyphs are loaded. Must be called after writing to CGRAM
+ * without going through load_glyph().
+ */
+void
+lcd::invalidate_glyphs()
+{
+	for (unsigned int i = 0; i < GLYPH_SLOTS; i++)
+		glyph_slots[i].used = false;
+	glyph_clock = 0;
+}
+
+/**
+ * Starts scrolling a text on a row using the controller display shift.
+ *
+ * The whole 40 cells DDRAM line is filled up front; afterwards each
+ * marquee_step() shifts the display by one column and writes only the
+ * newly exposed cell, and only if it doesn't already hold the right
+ * character.
+ *
+ * @warning The display shift moves every row, so only rows 0 and 1 of
+ * 1 or 2 line modules are supported and any other text shown on the
+ * display scrolls along.
+ */
+void
+lcd::marquee(const std::string &text, unsigned int row, unsigned int width)
+{
+	if (text.empty() || row > 1 || width == 0 || width > LCD_VAL_DDRAM_LINE_LEN)
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	marquee_text = text;
+	marquee_row = row;
+	marquee_width = width;
+	marquee_pos = 0;
+	marquee_offset = 0;
+
+	for (unsigned int i = 0; i < LCD_VAL_DDRAM_LINE_LEN; i++)
+		marquee_cells[i] = text[i % text.size()];
+
+	// Home also undoes any previous display shift.
+	home();
+	wait();
+
+	ddram(0, row);
+	wait();
+	print(marquee_cells, sizeof(marquee_cells));
+	wait();
+}
+
+void
+lcd::marquee_step()
+{
+	if (marquee_text.empty())
+		throw tsxx::exceptions::invalid_state();
+
+	const unsigned int col = (marquee_offset + marquee_width) % LCD_VAL_DDRAM_LINE_LEN;
+	const char c = marquee_text[(marquee_pos + marquee_width) % marquee_text.size()];
+
+	if (marquee_cells[col] != c) {
+		ddram(col, marquee_row);
+		wait();
+		print(&c, 1);
+		wait();
+		marquee_cells[col] = c;
+	}
+
+	shift(true, false);
+
+	marquee_offset = (marquee_offset + 1) % LCD_VAL_DDRAM_LINE_LEN;
+	marquee_pos = (marquee_pos + 1) % marquee_text.size();
+}
+
+uint32_t
+lcd::hash_glyph(const glyph &g)
+{
+	// FNV-1a.
+	uint32_t hash = 2166136261u;
+	for (unsigned int i = 0; i < sizeof(g.rows); i++) {
+		hash ^= g.rows[i];
+		hash *= 16777619u;
+	}
+	return hash;
 }
@@ -28,57 +28,797 @@
 // are those of the authors and should not be interpreted as representing
 // official policies, either expressed or implied, of Fernando Silveira.
 
+#include <errno.h>
 #include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include <linux/spi/spidev.h>
 
 #include <iostream>
 
 #include <tsxx/ts7300/devices.hpp>
 
 using tsxx::ts7300::devices::spi;
+using tsxx::ts7300::devices::spi_chip;
+
+namespace
+{
+
+/// Chip select for transfers which don't address any chip.
+class
+null_binport
+	: public tsxx::interfaces::binport
+{
+public:
+	void
+	set()
+	{
+	}
+
+	void
+	unset()
+	{
+	}
+
+};
+
+/// Pattern exercising every data line in both directions.
+const uint8_t calibration_pattern[] = {
+	0x00, 0xff, 0x55, 0xaa, 0x0f, 0xf0, 0x33, 0xcc,
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+	0xfe, 0xfd, 0xfb, 0xf7, 0xef, 0xdf, 0xbf, 0x7f,
+};
+
+/// Passes the calibration pattern through the controller's loopback.
+struct
+loopback_test
+{
+	spi &bus;
+	const unsigned int rounds;
+
+	bool
+	operator()(const spi::profile &p)
+	{
+		null_binport nocs;
+		uint8_t rd[sizeof(calibration_pattern)];
+
+		bus.configure(p);
+		for (unsigned int i = 0; i < rounds; i++) {
+			bus.write_read(nocs, calibration_pattern, sizeof(calibration_pattern), rd, sizeof(rd));
+			if (memcmp(rd, calibration_pattern, sizeof(rd)) != 0)
+				return false;
+		}
+
+		return true;
+	}
+};
+
+/// Checks a chip's answer to a command.
+struct
+chip_test
+{
+	spi &bus;
+	tsxx::interfaces::binport &cs;
+	const std::vector<uint8_t> &command;
+	const std::vector<uint8_t> &expected;
+	const std::vector<uint8_t> &mask;
+	const unsigned int rounds;
+
+	bool
+	operator()(const spi::profile &p)
+	{
+		std::vector<uint8_t> rd(command.size());
+
+		bus.configure(p);
+		for (unsigned int i = 0; i < rounds; i++) {
+			bus.write_read(cs, command, rd);
+			for (std::size_t j = 0; j < rd.size(); j++)
+				if (((rd[j] ^ expected[j]) & mask[j]) != 0)
+					return false;
+		}
+
+		return true;
+	}
+};
+
+/**
+ * Finds the fastest profile between min_hz and max_hz passing a test,
+ * assuming that everything slower than a passing profile passes too.
+ *
+ * The rates are bisected, so a chip which never answers costs a few tens
+ * of tests instead of one per achievable rate. The result is tested once
+ * more and, should that fail, the next slower profiles are tried.
+ */
+template <class Test> spi::profile
+search_profile(unsigned long max_hz, unsigned long min_hz, unsigned int mode, Test &test)
+{
+	spi::profile p = spi::profile::for_frequency(max_hz, mode);
+	if (test(p))
+		return p;
+
+	spi::profile good = p;
+	bool found = false;
+	unsigned long lo = min_hz, hi = p.get_frequency() - 1;
+
+	while (lo <= hi) {
+		const unsigned long mid = lo + (hi - lo) / 2;
+		spi::profile q = spi::profile::for_frequency(mid, mode);
+		const unsigned long f = q.get_frequency();
+
+		if (f < min_hz)
+			break;
+		if (test(q)) {
+			good = q;
+			found = true;
+			lo = mid + 1;
+		} else {
+			// The slowest profile may be above mid.
+			const unsigned long top = f < mid ? f : mid;
+			if (top == 0)
+				break;
+			hi = top - 1;
+		}
+	}
+
+	if (!found)
+		throw tsxx::exceptions::unknown_error(__FILE__, __LINE__);
+
+	while (!test(good)) {
+		spi::profile slower = spi::profile::for_frequency(good.get_frequency() - 1, mode);
+		if (slower == good || slower.get_frequency() < min_hz)
+			throw tsxx::exceptions::unknown_error(__FILE__, __LINE__);
+		good = slower;
+	}
+
+	return good;
+}
+
+}
 
 spi::spi(tsxx::system::memory &memory)
-	: ctrl(memory.get_region(BASE_ADDR + 0x04)),
+	: cr0(memory.get_region(BASE_ADDR + 0x00)),
+	ctrl(memory.get_region(BASE_ADDR + 0x04)),
 	status(memory.get_region(BASE_ADDR + 0x0c)),
 	data(memory.get_region(BASE_ADDR + 0x08)),
+	cpsr(memory.get_region(BASE_ADDR + 0x10)),
 	tx_bit(ctrl, 4),
+	loopback_bit(ctrl, 3),
 	busy_bit(status, 4),
-	inp_bit(status, 2)
+	inp_bit(status, 2),
+	configured(false),
+	transferring(false),
+	waiters(NULL), owned(false), boosted(false), owner_depth(0)
+{
+	pthread_mutexattr_t attr;
+
+	// The arbitration state is only held for short periods, but don't let
+	// it become a source of priority inversion either.
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	int error = pthread_mutex_init(&arb_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	if (error != 0)
+		throw tsxx::exceptions::stdio_error(error);
+
+	// Timeouts are measured on the monotonic clock, so setting the
+	// wall clock doesn't stretch or cut them.
+	pthread_condattr_t cattr;
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	error = pthread_cond_init(&arb_cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+	if (error != 0) {
+		pthread_mutex_destroy(&arb_mutex);
+		throw tsxx::exceptions::stdio_error(error);
+	}
+}
+
+spi::~spi()
 {
+	pthread_cond_destroy(&arb_cond);
+	pthread_mutex_destroy(&arb_mutex);
 }
 
 void
 spi::init()
 {
+	configured = false;
+
+	// The kernel driver owns the controller.
+	if (uses_spidev())
+		return;
+
 	tx_bit.set();
-	FIXME(); while (busy_bit.get());
+	while (busy_bit.get())
+		;
 	tx_bit.unset();
-	FIXME(); while (busy_bit.get()); // Is this really necessary?
-	FIXME(); while (inp_bit.get())
+	while (busy_bit.get()) // Is this really necessary?
+		;
+	while (inp_bit.get())
 		(void)data.read();
 }
 
+/**
+ * Takes the bus for the calling thread. Ownership is recursive: a thread
+ * which already owns the bus gets it again right away and must call
+ * release() once per successful acquire().
+ *
+ * @param priority Higher values are served first.
+ * @param timeout_us How long to wait, or -1 to wait forever.
+ * @return false if the timeout expired.
+ */
+bool
+spi::acquire(int priority, long timeout_us)
+{
+	const pthread_t self = pthread_self();
+	bool ok = true;
+
+	// Only the owner itself sets the owner to itself, or changes the
+	// depth, so a recursive acquire needs no locking.
+	if (owned && pthread_equal(owner, self)) {
+		owner_depth++;
+		return true;
+	}
+
+	pthread_mutex_lock(&arb_mutex);
+
+	if (owned || waiters != NULL) {
+		struct timespec deadline;
+		if (timeout_us >= 0) {
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			deadline.tv_sec += timeout_us / 1000000;
+			deadline.tv_nsec += (timeout_us % 1000000) * 1000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+		}
+
+		waiter me;
+		me.priority = priority;
+		me.bypassed = 0;
+		me.next = NULL;
+		pthread_getschedparam(self, &me.policy, &me.param);
+
+		waiter **wp;
+		for (wp = &waiters; *wp != NULL; wp = &(*wp)->next)
+			;
+		*wp = &me;
+
+		if (owned)
+			boost(me);
+
+		while (owned || next_waiter() != &me) {
+			if (timeout_us < 0) {
+				pthread_cond_wait(&arb_cond, &arb_mutex);
+			} else if (pthread_cond_timedwait(&arb_cond, &arb_mutex, &deadline) == ETIMEDOUT) {
+				ok = !owned && next_waiter() == &me;
+				break;
+			}
+			if (owned)
+				boost(me);
+		}
+
+		for (wp = &waiters; *wp != &me; wp = &(*wp)->next)
+			;
+		*wp = me.next;
+
+		if (ok) {
+			for (waiter *w = waiters; w != NULL; w = w->next)
+				w->bypassed++;
+		} else {
+			// The owner may have been boosted for this waiter only.
+			if (owned)
+				reboost();
+			// Someone else may be next now.
+			pthread_cond_broadcast(&arb_cond);
+		}
+	}
+
+	if (ok) {
+		owner = self;
+		owner_depth = 1;
+		boosted = false;
+		owned = true;
+	}
+
+	pthread_mutex_unlock(&arb_mutex);
+
+	return ok;
+}
+
 void
-spi::write_read(tsxx::interfaces::binport &cs, const void *wrp, std::size_t wrsiz, void *rdp, std::size_t rdsiz)
+spi::release()
 {
-	const uint8_t *cp;
-	uint8_t *p;
+	const pthread_t self = pthread_self();
 
-	if (wrsiz > rdsiz)
+	if (!owned || !pthread_equal(owner, self))
+		throw tsxx::exceptions::invalid_state();
+
+	// Nested releases don't touch the arbitration state either.
+	if (owner_depth > 1) {
+		owner_depth--;
+		return;
+	}
+
+	pthread_mutex_lock(&arb_mutex);
+
+	owner_depth = 0;
+	if (boosted)
+		pthread_setschedparam(self, owner_policy, &owner_param);
+	owned = false;
+	boosted = false;
+	if (waiters != NULL)
+		pthread_cond_broadcast(&arb_cond);
+
+	pthread_mutex_unlock(&arb_mutex);
+}
+
+/**
+ * Returns the waiter which gets the bus next. Must be called with the
+ * arbitration mutex held.
+ */
+spi::waiter *
+spi::next_waiter()
+{
+	waiter *best = NULL;
+
+	for (waiter *w = waiters; w != NULL; w = w->next) {
+		if (w->bypassed >= BYPASS_LIMIT)
+			return w;
+		if (best == NULL || w->priority > best->priority)
+			best = w;
+	}
+
+	return best;
+}
+
+/**
+ * Priority inheritance: raises the bus owner to the scheduling priority of
+ * a real-time waiter. Errors (e.g. no permission) are ignored, the owner
+ * is just not boosted. Must be called with the arbitration mutex held.
+ */
+void
+spi::boost(const waiter &w)
+{
+	if (w.policy != SCHED_FIFO && w.policy != SCHED_RR)
+		return;
+
+	int policy;
+	struct sched_param param;
+	if (pthread_getschedparam(owner, &policy, &param) != 0)
+		return;
+
+	if ((policy == SCHED_FIFO || policy == SCHED_RR) &&
+			param.sched_priority >= w.param.sched_priority)
+		return;
+
+	// The owner's own parameters are only needed once it is boosted.
+	if (!boosted) {
+		owner_policy = policy;
+		owner_param = param;
+	}
+
+	if (pthread_setschedparam(owner, w.policy, &w.param) == 0)
+		boosted = true;
+}
+
+/**
+ * Recomputes the owner's boost from the remaining waiters, after one of
+ * them left. Must be called with the arbitration mutex held.
+ */
+void
+spi::reboost()
+{
+	if (!boosted)
+		return;
+
+	pthread_setschedparam(owner, owner_policy, &owner_param);
+	boosted = false;
+
+	for (waiter *w = waiters; w != NULL; w = w->next)
+		boost(*w);
+}
+
+/**
+ * Programs the clock and mode of a profile. Nothing is written when it is
+ * already the one in use, so it is cheap to call before every transfer.
+ */
+void
+spi::configure(const profile &p)
+{
+	lock l(*this);
+
+	if (configured && p == current)
+		return;
+
+	if (p.prescaler < 2 || (p.prescaler & 1) != 0 || p.bits < 4 || p.bits > 16)
 		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
 
-	if (rdsiz > wrsiz)
-		rdsiz = wrsiz;
+	if (uses_spidev()) {
+		uint8_t mode = (p.cpol ? SPI_CPOL : 0) | (p.cpha ? SPI_CPHA : 0) | SPI_NO_CS;
+		// ENOTTY: not a spidev, see use_spidev().
+		if (ioctl(spidev->get_value(), SPI_IOC_WR_MODE, &mode) == -1 && errno != ENOTTY)
+			throw tsxx::exceptions::stdio_error(errno);
 
-	for (cp = static_cast<const uint8_t *>(wrp); wrsiz > 0; cp++, wrsiz--)
-		data.write(*cp);
+		// Clock and frame size go with every message.
+		current = p;
+		configured = true;
+		return;
+	}
 
-	cs.set();
+	// The controller is only enabled during transfers, so it is safe to
+	// change its clock here.
+	cr0.write((p.rate << 8) |
+			(p.cpha ? SSPCR0_SPH : 0) |
+			(p.cpol ? SSPCR0_SPO : 0) |
+			SSPCR0_FRF_SPI |
+			((p.bits - 1) & SSPCR0_DSS_MASK));
+	cpsr.write(p.prescaler);
+
+	current = p;
+	configured = true;
+}
+
+unsigned long
+spi::profile::get_frequency() const
+{
+	return SSPCLK / (prescaler * (1ul + rate));
+}
+
+spi::profile
+spi::profile::for_frequency(unsigned long hz, unsigned int mode, unsigned int bits)
+{
+	profile best = { 254, 255, (mode & 2) != 0, (mode & 1) != 0, static_cast<uint8_t>(bits) };
+	unsigned long best_hz = best.get_frequency();
 
+	if (hz > SSPCLK)
+		hz = SSPCLK;
+	if (hz <= best_hz)
+		return best;
+
+	for (unsigned long prescaler = 2; prescaler <= 254; prescaler += 2) {
+		// Smallest divisor giving a bit rate not above hz.
+		unsigned long div = (SSPCLK + prescaler * hz - 1) / (prescaler * hz);
+		if (div > 256)
+			continue;
+
+		profile p = best;
+		p.prescaler = prescaler;
+		p.rate = div - 1;
+		if (p.get_frequency() > best_hz) {
+			best = p;
+			best_hz = p.get_frequency();
+		}
+	}
+
+	return best;
+}
+
+/**
+ * Finds the fastest profile, between min_hz and max_hz, at which the
+ * controller passes a pattern through its internal loopback without
+ * errors in all of the rounds. The profile in use is left untouched.
+ *
+ * This only qualifies the controller itself; use spi_chip::calibrate()
+ * to take wiring into account.
+ */
+spi::profile
+spi::calibrate(unsigned long max_hz, unsigned int mode, unsigned int rounds,
+		unsigned long min_hz)
+{
+	lock l(*this);
+
+	// The registers belong to the kernel driver.
+	if (uses_spidev())
+		throw tsxx::exceptions::invalid_state();
+
+	loopback_test test = { *this, rounds };
+	profile p;
+	const bool was_configured = configured;
+	const profile saved = current;
+
+	loopback_bit.set();
+	try {
+		p = search_profile(max_hz, min_hz, mode, test);
+	} catch (...) {
+		loopback_bit.unset();
+		throw;
+	}
+	loopback_bit.unset();
+
+	if (was_configured)
+		configure(saved);
+
+	return p;
+}
+
+/**
+ * Full-duplex transfer of a list of segments under a single chip select
+ * assertion, one FIFO entry per Word.
+ */
+template <class Word, class Segment> void
+spi::run(tsxx::interfaces::binport &cs, const Segment *segs, std::size_t nsegs)
+{
+	lock l(*this);
+	progress pos;
+
+	// Only an async_transfer of this very thread can be in the way.
+	if (transferring)
+		throw tsxx::exceptions::invalid_state();
+
+	if (uses_spidev()) {
+		spidev_transfer(cs, segs, nsegs);
+		return;
+	}
+
+	begin(cs, pos);
+	while (!pump<Word>(segs, nsegs, pos))
+		;
+	while (busy_bit.get())
+		;
+	end(cs);
+}
+
+void
+spi::begin(tsxx::interfaces::binport &cs, progress &pos)
+{
+	pos.txseg = pos.txoff = pos.rxseg = pos.rxoff = pos.inflight = 0;
+	transferring = true;
+
+	cs.set();
 	tx_bit.set();
-	FIXME(); while (busy_bit.get());
-	for (p = static_cast<uint8_t *>(rdp); rdsiz > 0; p++, rdsiz--)
-		*p = data.read();
-	tx_bit.unset();
+}
+
+/**
+ * Moves data until the FIFOs allow no more progress.
+ *
+ * The TX FIFO is kept topped up while the RX FIFO is drained, never
+ * letting more than FIFO_DEPTH frames be in flight so that the RX FIFO
+ * can't overrun.
+ *
+ * @return true once every frame has been received.
+ */
+template <class Word, class Segment> bool
+spi::pump(const Segment *segs, std::size_t nsegs, progress &pos)
+{
+	for (;;) {
+		while (pos.txseg < nsegs && pos.txoff == segs[pos.txseg].len) {
+			pos.txseg++;
+			pos.txoff = 0;
+		}
+		while (pos.rxseg < nsegs && pos.rxoff == segs[pos.rxseg].len) {
+			pos.rxseg++;
+			pos.rxoff = 0;
+		}
+		if (pos.rxseg == nsegs)
+			return true;
+
+		tsxx::ports::port16::word_type st = status.read();
+		bool moved = false;
+
+		if ((st & SSPSR_TNF) && pos.txseg < nsegs && pos.inflight < FIFO_DEPTH) {
+			const Segment &seg = segs[pos.txseg];
+			data.write(seg.tx != NULL ? static_cast<const Word *>(seg.tx)[pos.txoff] : 0);
+			pos.txoff++;
+			pos.inflight++;
+			moved = true;
+		}
 
+		if (st & SSPSR_RNE) {
+			const Segment &seg = segs[pos.rxseg];
+			Word dat = data.read();
+			if (seg.rx != NULL)
+				static_cast<Word *>(seg.rx)[pos.rxoff] = dat;
+			pos.rxoff++;
+			pos.inflight--;
+			moved = true;
+		}
+
+		if (!moved)
+			return false;
+	}
+}
+
+/**
+ * Ends a transfer. The controller must not be busy anymore.
+ */
+void
+spi::end(tsxx::interfaces::binport &cs)
+{
+	tx_bit.unset();
 	cs.unset();
+
+	transferring = false;
+}
+
+spi::async_transfer::async_transfer(spi_chip &chip, const segment *_segs, std::size_t _nsegs)
+	: bus(*chip.port), cs(chip.cs), segs(_segs), nsegs(_nsegs),
+	prof(chip.has_profile ? &chip.prof : NULL), priority(chip.priority), state(IDLE)
+{
+}
+
+/**
+ * A transfer dropped before it finished (e.g. by an exception unwinding
+ * the scheduler) is abandoned: the frames already queued go out, the
+ * received ones are discarded, and the chip and the bus are let go.
+ */
+spi::async_transfer::~async_transfer()
+{
+	if (state != RUNNING && state != DRAINING)
+		return;
+
+	while (bus.busy_bit.get())
+		;
+	while (bus.inp_bit.get())
+		(void)bus.data.read();
+	bus.end(cs);
+
+	try {
+		bus.release();
+	} catch (...) {
+		// Not destroyed by the thread owning the bus.
+	}
+}
+
+bool
+spi::async_transfer::poll()
+{
+	switch (state) {
+	case IDLE:
+		if (!bus.acquire(priority, 0))
+			return false;
+		if (bus.transferring) {
+			bus.release();
+			return false;
+		}
+		try {
+			if (prof != NULL)
+				bus.configure(*prof);
+			if (bus.configured && bus.current.bits > 8)
+				throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+			// The kernel driver can't be polled: the whole transfer
+			// happens in this poll.
+			if (bus.uses_spidev()) {
+				bus.spidev_transfer(cs, segs, nsegs);
+				bus.release();
+				state = DONE;
+				return true;
+			}
+		} catch (...) {
+			bus.release();
+			throw;
+		}
+		bus.begin(cs, pos);
+		state = RUNNING;
+		// Fall through.
+	case RUNNING:
+		if (!bus.pump<uint8_t>(segs, nsegs, pos))
+			return false;
+		state = DRAINING;
+		// Fall through.
+	case DRAINING:
+		if (bus.busy_bit.get())
+			return false;
+		bus.end(cs);
+		bus.release();
+		state = DONE;
+		// Fall through.
+	case DONE:
+	default:
+		return true;
+	}
+}
+
+void
+spi::transfer(tsxx::interfaces::binport &cs, const segment *segs, std::size_t nsegs)
+{
+	lock l(*this);
+
+	// Frames wider than a byte would be cut down; use segment16.
+	if (configured && current.bits > 8)
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	run<uint8_t>(cs, segs, nsegs);
+}
+
+/**
+ * Same as the byte oriented transfer(), for frames of up to 16 bits
+ * (see profile::bits).
+ */
+void
+spi::transfer(tsxx::interfaces::binport &cs, const segment16 *segs, std::size_t nsegs)
+{
+	run<uint16_t>(cs, segs, nsegs);
+}
+
+void
+spi::write_read(tsxx::interfaces::binport &cs, const void *wrp, std::size_t wrsiz, void *rdp, std::size_t rdsiz)
+{
+	if (wrsiz > rdsiz)
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	segment seg = { wrp, rdp, wrsiz };
+	transfer(cs, &seg, 1);
+}
+
+void
+spi::write_read(tsxx::interfaces::binport &cs, const uint16_t *wrp, uint16_t *rdp, std::size_t n)
+{
+	segment16 seg = { wrp, rdp, n };
+	transfer(cs, &seg, 1);
+}
+
+/**
+ * Finds the fastest profile, between min_hz and max_hz, at which the chip
+ * gives the expected answer to a command in all of the rounds, and makes it the
+ * profile of the chip. Only the bits set in mask are compared.
+ *
+ * The search starts at the loopback limit of the controller (at max_hz
+ * with the spidev backend). The CPOL,
+ * CPHA and frame width of the current profile are kept; the command is
+ * sent in 8 bit frames.
+ */
+spi::profile
+spi_chip::calibrate(unsigned long max_hz, const std::vector<uint8_t> &command,
+		const std::vector<uint8_t> &expected, const std::vector<uint8_t> &mask,
+		unsigned int rounds, unsigned long min_hz)
+{
+	if (command.empty() || expected.size() != command.size() || mask.size() != command.size())
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	spi::lock l(*port, priority, timeout_us);
+	const unsigned int mode = has_profile ? (prof.cpol ? 2 : 0) | (prof.cpha ? 1 : 0) : 0;
+	const unsigned long limit = port->uses_spidev() ?
+		max_hz : port->calibrate(max_hz, mode, rounds, min_hz).get_frequency();
+
+	chip_test test = { *port, cs, command, expected, mask, rounds };
+	spi::profile p = search_profile(limit, min_hz, mode, test);
+
+	// The search runs in 8 bit frames, the chip keeps its own width.
+	if (has_profile)
+		p.bits = prof.bits;
+
+	set_profile(p);
+
+	return p;
+}
+
+/**
+ * Profiles are written as "prescaler rate cpol cpha bits" so that
+ * calibration results can be saved and loaded back.
+ */
+std::ostream &
+tsxx::ts7300::devices::operator<<(std::ostream &os, const spi::profile &p)
+{
+	return os << static_cast<unsigned int>(p.prescaler) << ' ' <<
+		static_cast<unsigned int>(p.rate) << ' ' <<
+		p.cpol << ' ' << p.cpha << ' ' <<
+		static_cast<unsigned int>(p.bits);
+}
+
+std::istream &
+tsxx::ts7300::devices::operator>>(std::istream &is, spi::profile &p)
+{
+	unsigned int prescaler, rate, bits;
+	bool cpol, cpha;
+
+	if (!(is >> prescaler >> rate >> cpol >> cpha >> bits))
+		return is;
+
+	if (prescaler < 2 || prescaler > 254 || (prescaler & 1) != 0 || rate > 255 ||
+			bits < 4 || bits > 16) {
+		is.setstate(std::ios::failbit);
+		return is;
+	}
+
+	p.prescaler = prescaler;
+	p.rate = rate;
+	p.cpol = cpol;
+	p.cpha = cpha;
+	p.bits = bits;
+
+	return is;
 }
@@ -0,0 +1,152 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <linux/spi/spidev.h>
+
+#include <tsxx/ts7300/devices.hpp>
+
+using tsxx::ts7300::devices::spi;
+
+namespace
+{
+
+enum {
+	/// Transfers per SPI_IOC_MESSAGE ioctl.
+	SPIDEV_BATCH = 16,
+
+	/// Default size of the spidev buffer, the most one ioctl can move.
+	SPIDEV_BUFSIZ = 4096,
+};
+
+}
+
+/**
+ * Makes transfers go through a kernel spidev device instead of polling the
+ * SSP registers, e.g. to let an IRQ/DMA driven kernel driver do the work.
+ * The API, bus arbitration and profiles are the same for both backends.
+ *
+ * The device is put in SPI_NO_CS mode: chip selects are still driven by
+ * tsxx through the binport given to each transfer. Anything with a
+ * file_descriptor (e.g. a stand-in for tests) can be used as the device.
+ */
+void
+spi::use_spidev(tsxx::system::file_descriptor_ptr fd)
+{
+	lock l(*this);
+
+	if (fd.get() == NULL || !fd->is_valid())
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	// Right away, so transfers without a profile don't toggle the
+	// kernel's own chip select either. ENOTTY means it isn't a spidev
+	// at all (e.g. a stand-in), so there is no mode to set.
+	uint8_t mode = SPI_NO_CS;
+	if (ioctl(fd->get_value(), SPI_IOC_WR_MODE, &mode) == -1 && errno != ENOTTY)
+		throw tsxx::exceptions::stdio_error(errno);
+
+	spidev = fd;
+	configured = false;
+}
+
+/**
+ * Sends a list of segments as few SPI_IOC_MESSAGE ioctls as possible, the
+ * chip select being held for all of them.
+ */
+template <class Word, class Segment> void
+spi::spidev_run(tsxx::interfaces::binport &cs, const Segment *segs, std::size_t nsegs)
+{
+	struct spi_ioc_transfer xfers[SPIDEV_BATCH];
+	const uint32_t speed = configured ? current.get_frequency() : 0;
+	const uint8_t bits = configured ? current.bits : 0;
+	std::size_t n = 0, total = 0;
+
+	memset(xfers, 0, sizeof(xfers));
+
+	cs.set();
+	try {
+		for (std::size_t i = 0; i < nsegs; i++) {
+			const uint8_t *tx = static_cast<const uint8_t *>(static_cast<const void *>(segs[i].tx));
+			uint8_t *rx = static_cast<uint8_t *>(static_cast<void *>(segs[i].rx));
+			std::size_t len = segs[i].len * sizeof(Word);
+
+			while (len > 0) {
+				if (n == SPIDEV_BATCH || total == SPIDEV_BUFSIZ) {
+					if (ioctl(spidev->get_value(), SPI_IOC_MESSAGE(n), xfers) == -1)
+						throw tsxx::exceptions::stdio_error(errno);
+					memset(xfers, 0, sizeof(xfers));
+					n = total = 0;
+				}
+
+				std::size_t chunk = SPIDEV_BUFSIZ - total;
+				if (chunk > len)
+					chunk = len;
+				// Don't split words.
+				chunk -= chunk % sizeof(Word);
+
+				xfers[n].tx_buf = reinterpret_cast<unsigned long>(tx);
+				xfers[n].rx_buf = reinterpret_cast<unsigned long>(rx);
+				xfers[n].len = chunk;
+				xfers[n].speed_hz = speed;
+				xfers[n].bits_per_word = bits;
+				n++;
+				total += chunk;
+
+				if (tx != NULL)
+					tx += chunk;
+				if (rx != NULL)
+					rx += chunk;
+				len -= chunk;
+			}
+		}
+
+		if (n > 0 && ioctl(spidev->get_value(), SPI_IOC_MESSAGE(n), xfers) == -1)
+			throw tsxx::exceptions::stdio_error(errno);
+	} catch (...) {
+		cs.unset();
+		throw;
+	}
+	cs.unset();
+}
+
+void
+spi::spidev_transfer(tsxx::interfaces::binport &cs, const segment *segs, std::size_t nsegs)
+{
+	spidev_run<uint8_t>(cs, segs, nsegs);
+}
+
+void
+spi::spidev_transfer(tsxx::interfaces::binport &cs, const segment16 *segs, std::size_t nsegs)
+{
+	spidev_run<uint16_t>(cs, segs, nsegs);
+}
@@ -29,6 +29,7 @@
 // official policies, either expressed or implied, of Fernando Silveira.
 
 #include <errno.h>
+#include <unistd.h>
 
 #include <tsxx/ts7300/devices.hpp>
 
@@ -45,6 +46,10 @@ xdio::xdio(tsxx::system::memory &memory, unsigned int n)
 		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
 
 	mode = UNINITIALIZED;
+	conf_bits = 0;
+	pwm_valid = false;
+	counter_last = 0;
+	counter_total = 0;
 }
 
 void
@@ -58,6 +63,15 @@ xdio::read_conf()
 {
 	tsxx::ports::port8::word_type c = conf.read();
 	mode = static_cast<mode_cfg>((c >> 6) & 0x03);
+	conf_bits = c & 0x3f;
+	pwm_valid = false;
+
+	// Already counting (e.g. left so by another program): extend from
+	// the current count, not from zero.
+	if (mode == MODE_EDGEQUADCNTR) {
+		counter_last = read_counter_raw();
+		counter_total = 0;
+	}
 }
 
 void
@@ -74,12 +88,262 @@ xdio::write_conf()
 		throw tsxx::exceptions::invalid_state();
 	}
 
-	conf.write(mode << 6);
+	conf.write((mode << 6) | (conf_bits & 0x3f));
 }
 
 void
 xdio::set_mode_dio()
 {
 	mode = MODE_DIO;
+	conf_bits = 0;
+	write_conf();
+}
+
+/**
+ * Switches to PWM mode. The output stays low until set_pwm() is called.
+ *
+ * @param prescaler The counter runs at PWM_CLOCK / 2^prescaler (0 to 15).
+ */
+void
+xdio::set_mode_pwm(unsigned int prescaler)
+{
+	if (prescaler > 0x0f)
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	mode = MODE_PWM;
+	conf_bits = prescaler;
+	write_conf();
+
+	pwm p = { 0, 1 };
+	pwm_valid = false;
+	set_pwm(p);
+}
+
+/**
+ * Switches to counter mode. In COUNT_EDGES mode every input edge
+ * increments the counter, in COUNT_QUADRATURE mode the first two inputs
+ * are decoded as an encoder's A and B phases.
+ */
+void
+xdio::set_mode_counter(counter_type type)
+{
+	mode = MODE_EDGEQUADCNTR;
+	conf_bits = type;
+	write_conf();
+
+	counter_last = read_counter_raw();
+	counter_total = 0;
+}
+
+/**
+ * Switches to input pulse timer mode. The high and low times of the first
+ * input are measured in periods of PWM_CLOCK / 2^prescaler.
+ *
+ * @param prescaler From 0 to 15.
+ */
+void
+xdio::set_mode_pulse_timer(unsigned int prescaler)
+{
+	if (prescaler > 0x0f)
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	mode = MODE_INPULSTIMER;
+	conf_bits = prescaler;
 	write_conf();
 }
+
+/**
+ * Reads reg1..reg3 until two consecutive readings agree, so a measurement
+ * updated between the byte reads is never mixed with the previous one.
+ */
+void
+xdio::read_regs(pwm_regs &r)
+{
+	pwm_regs again;
+
+	again.r1 = reg1.read();
+	again.r2 = reg2.read();
+	again.r3 = reg3.read();
+	do {
+		r = again;
+		again.r1 = reg1.read();
+		again.r2 = reg2.read();
+		again.r3 = reg3.read();
+	} while (r.r1 != again.r1 || r.r2 != again.r2 || r.r3 != again.r3);
+}
+
+/**
+ * The pulse timer uses the same register layout of the PWM mode.
+ */
+bool
+xdio::read_pulse(pulse &p)
+{
+	if (mode != MODE_INPULSTIMER)
+		throw tsxx::exceptions::invalid_state();
+
+	pwm_regs r;
+	read_regs(r);
+
+	p.high = r.r1 | ((r.r3 & 0x0f) << 8);
+	p.low = r.r2 | ((r.r3 & 0xf0) << 4);
+
+	return p.high != 0 && p.low != 0 && p.high != PWM_MAX && p.low != PWM_MAX;
+}
+
+void
+xdio::sample_pulses(pulse_stats &stats, unsigned int n, unsigned long interval_us)
+{
+	pulse p;
+
+	for (unsigned int i = 0; i < n; i++) {
+		if (i && interval_us)
+			usleep(interval_us);
+		if (read_pulse(p))
+			stats.add(p);
+		else
+			stats.invalid++;
+	}
+}
+
+/**
+ * Counter register layout: reg1 holds bits 7-0 and reg2 bits 15-8 of a
+ * 16 bits counter. The counter keeps running between both reads, so the
+ * high byte is read again and the read repeated if a carry happened.
+ */
+uint16_t
+xdio::read_counter_raw()
+{
+	if (mode != MODE_EDGEQUADCNTR)
+		throw tsxx::exceptions::invalid_state();
+
+	tsxx::ports::port8::word_type hi, lo;
+	do {
+		hi = reg2.read();
+		lo = reg1.read();
+	} while (reg2.read() != hi);
+
+	return (static_cast<uint16_t>(hi) << 8) | lo;
+}
+
+int64_t
+xdio::extend_counter(uint16_t raw)
+{
+	counter_total += static_cast<int16_t>(static_cast<uint16_t>(raw - counter_last));
+	counter_last = raw;
+
+	return counter_total;
+}
+
+int64_t
+xdio::read_counter()
+{
+	return extend_counter(read_counter_raw());
+}
+
+void
+xdio::reset_counter()
+{
+	read_counter();
+	counter_total = 0;
+}
+
+/**
+ * Reads the counters of up to both XDIO ports back to back, with a single
+ * timestamp.
+ */
+void
+xdio::read_counters(xdio *const *ports, std::size_t n, timer &t, counter_snapshot &snap)
+{
+	if (n > sizeof(snap.counts) / sizeof(snap.counts[0]))
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	for (std::size_t i = 0; i < n; i++)
+		if (ports[i]->mode != MODE_EDGEQUADCNTR)
+			throw tsxx::exceptions::invalid_state();
+
+	uint16_t raw[2];
+	uint32_t t0 = t.read();
+	for (std::size_t i = 0; i < n; i++)
+		raw[i] = ports[i]->read_counter_raw();
+	uint32_t t1 = t.read();
+
+	// Extension is done after sampling to keep the window short.
+	for (std::size_t i = 0; i < n; i++)
+		snap.counts[i] = ports[i]->extend_counter(raw[i]);
+	snap.timestamp = t0 + (t1 - t0) / 2;
+}
+
+/**
+ * PWM register layout: reg1 holds bits 7-0 of the high time, reg2 bits
+ * 7-0 of the low time and reg3 bits 11-8 of the high (low nibble) and low
+ * (high nibble) times. The FPGA takes the new waveform when reg3 is
+ * written, at the end of the current period, so writing reg3 last makes
+ * updates glitch-free.
+ */
+xdio::pwm_regs
+xdio::encode_pwm(const pwm &p)
+{
+	if (p.high > PWM_MAX || p.low > PWM_MAX)
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	pwm_regs r;
+	r.r1 = p.high & 0xff;
+	r.r2 = p.low & 0xff;
+	r.r3 = ((p.high >> 8) & 0x0f) | (((p.low >> 8) & 0x0f) << 4);
+	return r;
+}
+
+void
+xdio::write_pwm_low(const pwm_regs &r)
+{
+	if (mode != MODE_PWM)
+		throw tsxx::exceptions::invalid_state();
+
+	// Unchanged bytes don't need to be written again.
+	if (!pwm_valid || r.r1 != pwm_shadow.r1)
+		reg1.write(r.r1);
+	if (!pwm_valid || r.r2 != pwm_shadow.r2)
+		reg2.write(r.r2);
+}
+
+void
+xdio::write_pwm_latch(const pwm_regs &r)
+{
+	reg3.write(r.r3);
+	pwm_shadow = r;
+	pwm_valid = true;
+}
+
+void
+xdio::set_pwm(const pwm &p)
+{
+	pwm_regs r = encode_pwm(p);
+	write_pwm_low(r);
+	write_pwm_latch(r);
+}
+
+/**
+ * Updates several PWM channels at once. Everything is validated and
+ * encoded up front and all the latching reg3 writes are issued back to
+ * back, so the channels change as close together as possible.
+ */
+void
+xdio::set_pwm(xdio *const *ports, const pwm *values, std::size_t n)
+{
+	enum { MAX_PORTS = 2 };
+	pwm_regs r[MAX_PORTS];
+
+	if (n > MAX_PORTS)
+		throw tsxx::exceptions::invalid_argument(__FILE__, __LINE__);
+
+	for (std::size_t i = 0; i < n; i++) {
+		if (ports[i]->mode != MODE_PWM)
+			throw tsxx::exceptions::invalid_state();
+		r[i] = encode_pwm(values[i]);
+	}
+
+	for (std::size_t i = 0; i < n; i++)
+		ports[i]->write_pwm_low(r[i]);
+	for (std::size_t i = 0; i < n; i++)
+		ports[i]->write_pwm_latch(r[i]);
+}
@@ -0,0 +1,139 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#include <unistd.h>
+
+#include <exception>
+
+#include <tsxx/ts7300/executor.hpp>
+
+using tsxx::ts7300::executor;
+
+executor::executor(board &b, unsigned int _idle_us)
+	: brd(b), idle_us(_idle_us), channels(NULL), started(false), stopping(false)
+{
+}
+
+executor::~executor()
+{
+	stop();
+}
+
+/**
+ * Adds an application channel. Channels can only be attached while the
+ * I/O thread isn't running.
+ */
+void
+executor::attach(channel &c)
+{
+	if (started)
+		throw tsxx::exceptions::invalid_state();
+
+	c.next = channels;
+	channels = &c;
+}
+
+void
+executor::start()
+{
+	if (started)
+		throw tsxx::exceptions::invalid_state();
+
+	stopping = false;
+	int error = pthread_create(&thread, NULL, thread_main, this);
+	if (error != 0)
+		throw tsxx::exceptions::stdio_error(error);
+	started = true;
+}
+
+/**
+ * Stops the I/O thread once it has run everything already submitted.
+ */
+void
+executor::stop()
+{
+	if (!started)
+		return;
+
+	stopping = true;
+	pthread_join(thread, NULL);
+	started = false;
+}
+
+void *
+executor::thread_main(void *arg)
+{
+	executor *self = static_cast<executor *>(arg);
+
+	for (;;) {
+		if (self->run_pending())
+			continue;
+		if (self->stopping)
+			break;
+		usleep(self->idle_us);
+	}
+
+	return NULL;
+}
+
+/**
+ * Runs everything pending on all channels. Returns false if there was
+ * nothing to run.
+ */
+bool
+executor::run_pending()
+{
+	bool found = false;
+
+	for (channel *c = channels; c != NULL; c = c->next) {
+		operation *op;
+
+		while (c->submissions.pop(op)) {
+			try {
+				op->run(brd);
+				op->failed = false;
+			} catch (std::exception &e) {
+				op->failed = true;
+				op->error = e.what();
+			} catch (...) {
+				op->failed = true;
+				op->error = "unknown error";
+			}
+
+			// Can't fail: a channel never has more operations
+			// outstanding than its completion ring holds.
+			(void)c->completions.push(op);
+
+			found = true;
+		}
+	}
+
+	return found;
+}
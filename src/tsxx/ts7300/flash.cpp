@@ -0,0 +1,175 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+#include <tsxx/ts7300/flash.hpp>
+
+using tsxx::ts7300::spi_flash;
+using tsxx::ts7300::devices::spi;
+
+spi_flash::spi_flash(devices::spi_chip &_chip, tsxx::system::memory &memory)
+	: chip(_chip),
+	eeprom_cs_port(memory.get_region(board::EEPROM_CS_ADDR)),
+	eeprom_cs_bit(eeprom_cs_port, board::EEPROM_CS_BIT)
+{
+}
+
+/**
+ * Returns the JEDEC manufacturer and device ID (3 bytes).
+ */
+uint32_t
+spi_flash::read_id()
+{
+	uint8_t cmd = CMD_RDID, id[3];
+	spi::segment segs[] = {
+		{ &cmd, NULL, sizeof(cmd) },
+		{ NULL, id, sizeof(id) },
+	};
+
+	chip.transfer(segs, 2);
+
+	return (id[0] << 16) | (id[1] << 8) | id[2];
+}
+
+/**
+ * Reads any amount of data with a single fast read command.
+ */
+void
+spi_flash::read(uint32_t addr, void *buf, std::size_t len)
+{
+	uint8_t cmd[5];
+	spi::segment segs[] = {
+		{ cmd, NULL, sizeof(cmd) },
+		{ NULL, buf, len },
+	};
+
+	cmd[0] = CMD_FAST_READ;
+	set_address(&cmd[1], addr);
+	cmd[4] = 0; // Dummy byte.
+
+	chip.transfer(segs, 2);
+}
+
+void
+spi_flash::program(uint32_t addr, const void *buf, std::size_t len)
+{
+	program_task task(*this, addr, buf, len);
+
+	while (!task.poll())
+		;
+}
+
+void
+spi_flash::erase_sector(uint32_t addr)
+{
+	uint8_t cmd[4];
+	spi::segment seg = { cmd, NULL, sizeof(cmd) };
+
+	cmd[0] = CMD_SE;
+	set_address(&cmd[1], addr);
+
+	wait();
+	write_enable();
+	chip.transfer(&seg, 1);
+	wait();
+}
+
+bool
+spi_flash::busy()
+{
+	uint8_t cmd[2] = { CMD_RDSR, 0 }, rd[2];
+
+	chip.write_read(tsxx::buffers::span<const uint8_t>(cmd), tsxx::buffers::span<uint8_t>(rd));
+
+	return (rd[1] & SR_WIP) != 0;
+}
+
+void
+spi_flash::wait()
+{
+	while (busy())
+		;
+}
+
+void
+spi_flash::write_enable()
+{
+	if (eeprom_cs_bit.get()) {
+		eeprom_cs_bit.unset();
+		throw tsxx::exceptions::invalid_state();
+	}
+
+	uint8_t cmd = CMD_WREN;
+	chip.write_read(&cmd, sizeof(cmd));
+}
+
+/**
+ * Starts programming data which must not cross a page boundary.
+ */
+void
+spi_flash::write_page(uint32_t addr, const void *buf, std::size_t len)
+{
+	uint8_t cmd[4];
+	spi::segment segs[] = {
+		{ cmd, NULL, sizeof(cmd) },
+		{ buf, NULL, len },
+	};
+
+	cmd[0] = CMD_PP;
+	set_address(&cmd[1], addr);
+
+	write_enable();
+	chip.transfer(segs, 2);
+}
+
+bool
+spi_flash::program_task::poll()
+{
+	if (in_progress) {
+		if (flash.busy())
+			return false;
+		in_progress = false;
+	}
+
+	if (len == 0)
+		return true;
+
+	std::size_t n = PAGE_SIZE - addr % PAGE_SIZE;
+	if (n > len)
+		n = len;
+
+	flash.write_page(addr, buf, n);
+	in_progress = true;
+
+	addr += n;
+	buf += n;
+	len -= n;
+
+	return false;
+}
@@ -0,0 +1,144 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+// Checks that pool and ring never allocate once they are built. Global
+// operator new/delete are replaced with counting versions, and the steady
+// state loops must leave the counters untouched.
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <tsxx/buffers.hpp>
+
+namespace
+{
+
+unsigned long allocations = 0, deallocations = 0;
+
+bool failed = false;
+
+void
+expect(bool cond, const char *what)
+{
+	if (!cond) {
+		std::fprintf(stderr, "FAIL: %s\n", what);
+		failed = true;
+	}
+}
+
+void
+test_pool()
+{
+	tsxx::buffers::pool<int> pool(4, 64);
+
+	const unsigned long before = allocations, freed = deallocations;
+	for (int i = 0; i < 10000; i++) {
+		tsxx::buffers::span<int> a = pool.acquire();
+		tsxx::buffers::span<int> b = pool.acquire();
+		a[0] = i;
+		b[0] = i;
+		pool.release(a);
+		pool.release(b);
+
+		tsxx::buffers::pool<int>::buffer scoped(pool);
+		scoped.data()[0] = i;
+	}
+	expect(allocations == before && deallocations == freed, "pool acquire/release allocates");
+	expect(pool.available() == 4, "pool lost buffers");
+}
+
+void
+test_ring()
+{
+	tsxx::buffers::ring<int> ring(8);
+
+	const unsigned long before = allocations, freed = deallocations;
+	for (int i = 0; i < 10000; i++) {
+		int *slot = ring.back();
+		expect(slot != NULL, "ring full");
+		*slot = i;
+		ring.commit();
+		expect(ring.push(i + 1), "ring push failed");
+
+		int *v = ring.front();
+		expect(v != NULL && *v == i, "ring front mismatch");
+		ring.pop();
+		int w = -1;
+		expect(ring.pop(w) && w == i + 1, "ring pop mismatch");
+	}
+	expect(allocations == before && deallocations == freed, "ring push/pop allocates");
+	expect(ring.empty(), "ring not empty");
+}
+
+}
+
+void *
+operator new(std::size_t size) throw(std::bad_alloc)
+{
+	void *p = std::malloc(size != 0 ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	allocations++;
+	return p;
+}
+
+void *
+operator new[](std::size_t size) throw(std::bad_alloc)
+{
+	return operator new(size);
+}
+
+void
+operator delete(void *p) throw()
+{
+	if (p != NULL)
+		deallocations++;
+	std::free(p);
+}
+
+void
+operator delete[](void *p) throw()
+{
+	operator delete(p);
+}
+
+int
+main()
+{
+	test_pool();
+	test_ring();
+
+	if (failed)
+		return 1;
+
+	std::printf("test_buffers: ok\n");
+	return 0;
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2011 Fernando Silveira <fsilveira@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// The views and conclusions contained in the software and documentation
+// are those of the authors and should not be interpreted as representing
+// official policies, either expressed or implied, of Fernando Silveira.
+
+// Drives uio_device with an eventfd standing in for /dev/uioN, as
+// gpio_irq does when no UIO driver is around.
+
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cstdio>
+
+#include <tsxx/system.hpp>
+
+namespace
+{
+
+bool failed = false;
+
+void
+expect(bool cond, const char *what)
+{
+	if (!cond) {
+		std::fprintf(stderr, "FAIL: %s\n", what);
+		failed = true;
+	}
+}
+
+void
+raise(int fd, uint64_t count)
+{
+	expect(::write(fd, &count, sizeof(count)) == sizeof(count), "eventfd write");
+}
+
+}
+
+int
+main()
+{
+	const int efd = eventfd(0, EFD_NONBLOCK);
+	if (efd == -1) {
+		std::perror("eventfd");
+		return 1;
+	}
+
+	tsxx::system::file_descriptor_ptr fd(new tsxx::system::file_descriptor(efd));
+	tsxx::system::uio_device uio;
+	uio.attach(fd);
+
+	// An eventfd has nothing to re-arm: the 4 bytes write is refused
+	// and must neither throw nor raise an interrupt.
+	uio.rearm();
+	expect(!uio.wait(0), "rearm raised an interrupt");
+
+	raise(efd, 1);
+	expect(uio.wait(0), "interrupt not seen");
+	uio.rearm();
+	expect(!uio.wait(0), "interrupt seen twice");
+
+	// Several interrupts before the wait are collapsed into one.
+	raise(efd, 3);
+	expect(uio.wait(100), "interrupts not seen");
+	expect(!uio.wait(10), "timeout not reported");
+
+	if (failed)
+		return 1;
+
+	std::printf("test_uio_device: ok\n");
+	return 0;
+}